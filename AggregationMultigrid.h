@@ -0,0 +1,370 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_AGGREGATIONMULTIGRID_H
+#define MARKOVPROCESSSOLVER_AGGREGATIONMULTIGRID_H
+
+#include "CompiledModel.h"
+#include "vector"
+#include "algorithm"
+#include <math.h>
+
+using namespace std;
+
+// Coarse-grid corrections for evaluating a fixed policy. The values of the
+// non-terminal states solve (I - discountFactor*P) v = b, where P holds the
+// transition probabilities under the policy; a sweep of the solver is
+// Gauss-Seidel on that system and removes error between nearby states
+// quickly, but error spread over the whole graph only one hop per sweep.
+//
+// This builds a hierarchy of smaller systems by aggregation: every level
+// groups each unassigned state with its unassigned neighbors, and the next
+// level's matrix sums the entries between groups (Galerkin coarsening with
+// piecewise constant prolongation). correction() runs one V-cycle on the
+// residual equation and uses it as the next search direction of GCR, which
+// keeps the unsmoothed coarse corrections from over- or undershooting.
+class AggregationMultigrid {
+
+private:
+    // coarsening stops below this many states
+    static const int COARSEST = 100;
+    // a coarsest level up to this size is solved directly, a larger one (when
+    // aggregation stalls) only smoothed
+    static const int DIRECT = 1500;
+    // Gauss-Seidel sweeps before and after the coarse correction on every level
+    static const int SMOOTHING = 2;
+    // earlier search directions kept by GCR before it starts over
+    static const int RESTART = 10;
+
+    struct Level {
+        int size;
+        vector<int> offset, column;
+        vector<double> entry, diagonal;
+        // the aggregate of the next level every state of this one belongs to
+        vector<int> aggregate;
+        int coarseSize;
+    };
+
+    vector<Level> levels;
+    // position of each model state in the finest level, -1 for terminals
+    vector<int> fineIndex;
+    // LU factors of the coarsest level, row-major, with its row permutation
+    vector<double> factors;
+    vector<int> pivot;
+    // GCR search directions and their images under the finest matrix, the
+    // images orthonormal
+    vector<vector<double>> directions, appliedDirections;
+
+    static double dot(const vector<double> &a, const vector<double> &b) {
+        double sum = 0.0;
+        for (int i=0; i<a.size(); i++) {
+            sum += a[i]*b[i];
+        }
+        return sum;
+    }
+
+    static void multiply(const Level &level, const vector<double> &x, vector<double> &result) {
+        result.resize(level.size);
+        for (int row=0; row<level.size; row++) {
+            double sum = level.diagonal[row]*x[row];
+            for (int k=level.offset[row]; k<level.offset[row+1]; k++) {
+                sum += level.entry[k]*x[level.column[k]];
+            }
+            result[row] = sum;
+        }
+    }
+
+    void addRow(Level &level, const vector<int> &columns, vector<double> &accumulated, int row) {
+        level.diagonal.push_back(0.0);
+        for (int column: columns) {
+            if (column == row) {
+                level.diagonal.back() = accumulated[column];
+            } else if (accumulated[column] != 0.0) {
+                level.column.push_back(column);
+                level.entry.push_back(accumulated[column]);
+            }
+            accumulated[column] = 0.0;
+        }
+        level.offset.push_back(level.column.size());
+    }
+
+    // the rows of I - discountFactor*P over the non-terminal states
+    void buildFinest(const CompiledModel &model, const vector<int> &policy, double discountFactor) {
+        int n = model.numStates();
+        fineIndex.assign(n, -1);
+        Level level;
+        level.size = 0;
+        for (int node=0; node<n; node++) {
+            if (model.kind[node] != CompiledModel::TERMINAL) {
+                fineIndex[node] = level.size++;
+            }
+        }
+
+        level.offset.push_back(0);
+        vector<double> accumulated(level.size, 0.0);
+        vector<int> columns;
+        for (int node=0; node<n; node++) {
+            if (fineIndex[node] < 0) {
+                continue;
+            }
+            int row = fineIndex[node];
+            int degree = model.degree(node);
+            columns.assign(1, row);
+            accumulated[row] += 1.0;
+            for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                int neighbor = model.target[e];
+                double probability;
+                if (model.kind[node] == CompiledModel::CHANCE) {
+                    probability = model.weight[e];
+                } else if (neighbor == policy[node]) {
+                    probability = model.decisionProb[node];
+                } else {
+                    probability = degree > 1 ? (1.0 - model.decisionProb[node])/(degree - 1) : 0.0;
+                }
+                // terminal values are known, their terms belong to the right-hand side
+                if (fineIndex[neighbor] >= 0) {
+                    columns.push_back(fineIndex[neighbor]);
+                    accumulated[fineIndex[neighbor]] -= discountFactor*probability;
+                }
+            }
+            sort(columns.begin(), columns.end());
+            columns.erase(unique(columns.begin(), columns.end()), columns.end());
+            addRow(level, columns, accumulated, row);
+        }
+        levels.push_back(level);
+    }
+
+    // groups the states of the last level and appends the level of the groups;
+    // returns false when that would hardly shrink the system
+    bool coarsen() {
+        Level &fine = levels.back();
+        fine.aggregate.assign(fine.size, -1);
+        fine.coarseSize = 0;
+        for (int row=0; row<fine.size; row++) {
+            if (fine.aggregate[row] >= 0) {
+                continue;
+            }
+            int group = fine.coarseSize++;
+            fine.aggregate[row] = group;
+            for (int k=fine.offset[row]; k<fine.offset[row+1]; k++) {
+                if (fine.aggregate[fine.column[k]] < 0) {
+                    fine.aggregate[fine.column[k]] = group;
+                }
+            }
+        }
+        if (fine.coarseSize*5 > fine.size*4) {
+            return false;
+        }
+
+        vector<int> memberOffset(fine.coarseSize + 1, 0), member(fine.size);
+        for (int row=0; row<fine.size; row++) {
+            memberOffset[fine.aggregate[row] + 1]++;
+        }
+        for (int group=0; group<fine.coarseSize; group++) {
+            memberOffset[group+1] += memberOffset[group];
+        }
+        vector<int> fillAt(memberOffset.begin(), memberOffset.end() - 1);
+        for (int row=0; row<fine.size; row++) {
+            member[fillAt[fine.aggregate[row]]++] = row;
+        }
+
+        Level coarse;
+        coarse.size = fine.coarseSize;
+        coarse.offset.push_back(0);
+        vector<double> accumulated(coarse.size, 0.0);
+        vector<bool> seen(coarse.size, false);
+        vector<int> columns;
+        for (int group=0; group<coarse.size; group++) {
+            columns.clear();
+            for (int m=memberOffset[group]; m<memberOffset[group+1]; m++) {
+                int row = member[m];
+                auto add = [&](int column, double entry) {
+                    if (!seen[column]) {
+                        seen[column] = true;
+                        columns.push_back(column);
+                    }
+                    accumulated[column] += entry;
+                };
+                add(group, fine.diagonal[row]);
+                for (int k=fine.offset[row]; k<fine.offset[row+1]; k++) {
+                    add(fine.aggregate[fine.column[k]], fine.entry[k]);
+                }
+            }
+            sort(columns.begin(), columns.end());
+            for (int column: columns) {
+                seen[column] = false;
+            }
+            addRow(coarse, columns, accumulated, group);
+        }
+        levels.push_back(coarse);
+        return true;
+    }
+
+    // LU with partial pivoting of the coarsest level as a dense matrix
+    void factorCoarsest() {
+        const Level &level = levels.back();
+        int m = level.size;
+        factors.assign((size_t) m*m, 0.0);
+        for (int row=0; row<m; row++) {
+            factors[(size_t) row*m + row] = level.diagonal[row];
+            for (int k=level.offset[row]; k<level.offset[row+1]; k++) {
+                factors[(size_t) row*m + level.column[k]] += level.entry[k];
+            }
+        }
+        pivot.resize(m);
+        for (int row=0; row<m; row++) {
+            pivot[row] = row;
+        }
+        for (int j=0; j<m; j++) {
+            int best = j;
+            for (int i=j+1; i<m; i++) {
+                if (fabs(factors[(size_t) i*m + j]) > fabs(factors[(size_t) best*m + j])) {
+                    best = i;
+                }
+            }
+            if (best != j) {
+                swap_ranges(factors.begin() + (size_t) j*m, factors.begin() + (size_t) (j+1)*m, factors.begin() + (size_t) best*m);
+                swap(pivot[j], pivot[best]);
+            }
+            double diagonal = factors[(size_t) j*m + j];
+            if (diagonal == 0.0) {
+                continue;
+            }
+            for (int i=j+1; i<m; i++) {
+                double factor = factors[(size_t) i*m + j] /= diagonal;
+                for (int k=j+1; k<m; k++) {
+                    factors[(size_t) i*m + k] -= factor*factors[(size_t) j*m + k];
+                }
+            }
+        }
+    }
+
+    void solveCoarsest(const vector<double> &rhs, vector<double> &x) {
+        if (pivot.empty()) {
+            for (int s=0; s<10; s++) {
+                smooth(levels.back(), rhs, x);
+            }
+            return;
+        }
+        int m = levels.back().size;
+        for (int i=0; i<m; i++) {
+            double sum = rhs[pivot[i]];
+            for (int k=0; k<i; k++) {
+                sum -= factors[(size_t) i*m + k]*x[k];
+            }
+            x[i] = sum;
+        }
+        for (int i=m-1; i>=0; i--) {
+            double sum = x[i];
+            for (int k=i+1; k<m; k++) {
+                sum -= factors[(size_t) i*m + k]*x[k];
+            }
+            double diagonal = factors[(size_t) i*m + i];
+            x[i] = diagonal != 0.0 ? sum/diagonal : 0.0;
+        }
+    }
+
+    void smooth(const Level &level, const vector<double> &rhs, vector<double> &x) {
+        for (int s=0; s<SMOOTHING; s++) {
+            for (int row=0; row<level.size; row++) {
+                if (level.diagonal[row] <= 0.0) {
+                    continue;
+                }
+                double sum = rhs[row];
+                for (int k=level.offset[row]; k<level.offset[row+1]; k++) {
+                    sum -= level.entry[k]*x[level.column[k]];
+                }
+                x[row] = sum/level.diagonal[row];
+            }
+        }
+    }
+
+    // approximately solves level l's system for rhs, starting from zero
+    void cycle(int l, const vector<double> &rhs, vector<double> &x) {
+        const Level &level = levels[l];
+        x.assign(level.size, 0.0);
+        if (l == levels.size() - 1) {
+            solveCoarsest(rhs, x);
+            return;
+        }
+
+        smooth(level, rhs, x);
+        vector<double> coarseRhs(level.coarseSize, 0.0), coarseX, applied;
+        multiply(level, x, applied);
+        for (int row=0; row<level.size; row++) {
+            coarseRhs[level.aggregate[row]] += rhs[row] - applied[row];
+        }
+        cycle(l + 1, coarseRhs, coarseX);
+        for (int row=0; row<level.size; row++) {
+            x[row] += coarseX[level.aggregate[row]];
+        }
+        smooth(level, rhs, x);
+    }
+
+public:
+    AggregationMultigrid(const CompiledModel &model, const vector<int> &policy, double discountFactor) {
+        buildFinest(model, policy, discountFactor);
+        while (levels.back().size > COARSEST && coarsen()) {
+        }
+        if (levels.back().size <= DIRECT) {
+            factorCoarsest();
+        }
+    }
+
+    int numLevels() {
+        return levels.size();
+    }
+
+    // residual holds evaluate(s) - value[s] for every state (ignored for
+    // terminals); returns the change that brings the values closer to the
+    // policy's exact values, zero for terminals. Successive calls are steps of
+    // restarted GCR preconditioned by a V-cycle, so every step leaves a
+    // residual no larger (in the 2-norm) than the one it was given.
+    vector<double> correction(const vector<double> &residual) {
+        const Level &fine = levels[0];
+        vector<double> rhs(fine.size), direction, applied;
+        for (int node=0; node<fineIndex.size(); node++) {
+            if (fineIndex[node] >= 0) {
+                rhs[fineIndex[node]] = residual[node];
+            }
+        }
+
+        cycle(0, rhs, direction);
+        multiply(fine, direction, applied);
+        for (int i=0; i<directions.size(); i++) {
+            double overlap = dot(applied, appliedDirections[i]);
+            for (int row=0; row<fine.size; row++) {
+                direction[row] -= overlap*directions[i][row];
+                applied[row] -= overlap*appliedDirections[i][row];
+            }
+        }
+        double length = sqrt(dot(applied, applied));
+        vector<double> change(fineIndex.size(), 0.0);
+        if (length == 0.0) {
+            directions.clear();
+            appliedDirections.clear();
+            return change;
+        }
+        for (int row=0; row<fine.size; row++) {
+            direction[row] /= length;
+            applied[row] /= length;
+        }
+
+        double step = dot(rhs, applied);
+        for (int node=0; node<fineIndex.size(); node++) {
+            if (fineIndex[node] >= 0) {
+                change[node] = step*direction[fineIndex[node]];
+            }
+        }
+        if (directions.size() == RESTART) {
+            directions.clear();
+            appliedDirections.clear();
+        }
+        directions.push_back(direction);
+        appliedDirections.push_back(applied);
+        return change;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_AGGREGATIONMULTIGRID_H
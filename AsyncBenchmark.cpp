@@ -0,0 +1,64 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+// Times full solves of one model with the sweep-synchronous (barrier)
+// evaluation and with -async, for 1, 2, 4, ... threads. The model is read
+// once; every solve starts from a fresh, unsolved copy of it.
+//
+//   AsyncBenchmark <input file> [discount factor] [max threads] [repeats]
+
+#include "MarkovProcessSolver.h"
+#include "iostream"
+#include "iomanip"
+#include "chrono"
+
+using namespace std;
+
+// best of repeats seconds for solving a copy of loaded with the given engine
+double timeSolve(const MarkovProcessSolver &loaded, ProgramArguments arguments, int threads, bool asynchronous, int repeats) {
+    arguments.threads = threads;
+    arguments.asynchronous = asynchronous;
+    double best = 1e18;
+    for (int r=0; r<repeats; r++) {
+        MarkovProcessSolver solver(loaded, &arguments);
+        auto start = chrono::steady_clock::now();
+        solver.solve(false);
+        best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout<<"usage: AsyncBenchmark <input file> [discount factor] [max threads] [repeats]"<<endl;
+        return 1;
+    }
+    ProgramArguments arguments;
+    arguments.inputFile = argv[1];
+    arguments.discountFactor = argc > 2 ? atof(argv[2]) : 0.99;
+    int maxThreads = argc > 3 ? atoi(argv[3]) : 64;
+    int repeats = argc > 4 ? atoi(argv[4]) : 3;
+
+    MarkovProcessSolver loaded(&arguments);
+    if (!loaded.hasValidInput() || loaded.numStates() == 0) {
+        cout<<"Cannot load "<<arguments.inputFile<<endl;
+        return 1;
+    }
+    cout<<loaded.numStates()<<" states, discount factor "<<arguments.discountFactor<<", "
+        <<thread::hardware_concurrency()<<" hardware threads, best of "<<repeats<<" solves"<<endl;
+    cout<<"threads   barrier s     async s  barrier speedup  async speedup  async/barrier"<<endl;
+
+    double barrierBase = 0.0, asyncBase = 0.0;
+    for (int threads=1; threads<=maxThreads; threads*=2) {
+        double barrier = timeSolve(loaded, arguments, threads, false, repeats);
+        double async = timeSolve(loaded, arguments, threads, true, repeats);
+        if (threads == 1) {
+            barrierBase = barrier;
+            asyncBase = async;
+        }
+        cout<<setw(7)<<threads<<fixed<<setprecision(3)<<setw(12)<<barrier<<setw(12)<<async
+            <<setprecision(2)<<setw(17)<<barrierBase/barrier<<setw(15)<<asyncBase/async<<setw(15)<<barrier/async<<endl;
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_ASYNCVALUEITERATION_H
+#define MARKOVPROCESSSOLVER_ASYNCVALUEITERATION_H
+
+#include "CompiledModel.h"
+#include "PolicyKernels.h"
+#include "thread"
+#include "atomic"
+#include "memory"
+#include <math.h>
+
+using namespace std;
+
+// Policy evaluation without a barrier between sweeps. Every thread owns a
+// contiguous range of states and keeps sweeping it, reading and publishing
+// values with relaxed atomic loads and stores, so a thread always sees some
+// recent value of its neighbors and never waits for the others.
+//
+// Termination: a global counter is bumped after every sweep that moved some
+// state by more than (1 - discountFactor) times the tolerance. A thread whose
+// sweep moved nothing that far, and during which the counter did not move,
+// records the counter value as its quiet epoch. Evaluation is over once
+// every thread is quiet at the epoch the counter still shows, i.e. all ranges
+// have been swept without any significant change anywhere since. Each thread
+// also stops after `iterations` sweeps of its own range.
+class AsyncValueIteration {
+
+private:
+    // padded so that threads publishing their epochs do not share cache lines
+    struct Epoch {
+        atomic<long long> quietAt;
+        double residual;
+        char padding[64];
+    };
+
+    const CompiledModel &model;
+    const vector<int> &policy;
+    double discountFactor, quiet;
+    int iterations, threads;
+    unique_ptr<atomic<double>[]> value;
+    unique_ptr<Epoch[]> epochs;
+    vector<int> start;
+    atomic<long long> changes;
+    atomic<bool> done;
+
+    // contiguous ranges of about equal cost, one state plus its edges each
+    void partition() {
+        int n = model.numStates();
+        long long work = n + model.target.size();
+        start.assign(1, 0);
+        long long cost = 0;
+        for (int node=0; node<n; node++) {
+            cost += 1 + model.degree(node);
+            if (cost*threads >= work*(long long) start.size() && start.size() < threads) {
+                start.push_back(node+1);
+            }
+        }
+        while (start.size() <= threads) {
+            start.push_back(n);
+        }
+    }
+
+    double load(int node) {
+        return value[node].load(memory_order_relaxed);
+    }
+
+    double evaluate(int node) {
+        auto read = [this](int neighbor) {
+            return load(neighbor);
+        };
+        int begin = model.offset[node], end = model.offset[node+1];
+        if (model.kind[node] == CompiledModel::DECISION) {
+            return decisionBackup(model.reward[node], model.target.data(), begin, end, policy[node],
+                                  model.decisionProb[node], discountFactor, read);
+        }
+        return chanceBackup(model.reward[node], model.target.data(), model.weight.data(), begin, end, discountFactor, read);
+    }
+
+    bool allQuietAt(long long epoch) {
+        for (int t=0; t<threads; t++) {
+            if (epochs[t].quietAt.load() != epoch) {
+                return false;
+            }
+        }
+        return changes.load() == epoch;
+    }
+
+    void work(int self) {
+        for (int sweep=0; sweep<iterations && !done.load(memory_order_relaxed); sweep++) {
+            long long before = changes.load();
+            double residual = 0.0;
+            for (int node=start[self]; node<start[self+1]; node++) {
+                if (model.kind[node] == CompiledModel::TERMINAL) {
+                    continue;
+                }
+                double newValue = evaluate(node);
+                residual = max(residual, fabs(newValue - load(node)));
+                value[node].store(newValue, memory_order_relaxed);
+            }
+            epochs[self].residual = residual;
+
+            if (residual > quiet) {
+                epochs[self].quietAt.store(-1);
+                changes.fetch_add(1);
+            } else if (changes.load() == before) {
+                epochs[self].quietAt.store(before);
+                if (allQuietAt(before)) {
+                    done.store(true);
+                }
+            } else {
+                epochs[self].quietAt.store(-1);
+            }
+        }
+    }
+
+public:
+    AsyncValueIteration(const CompiledModel &model, const vector<int> &policy, double discountFactor,
+                        double tolerance, int iterations, int threads) : model(model), policy(policy) {
+        this->discountFactor = discountFactor;
+        this->quiet = settledChange(discountFactor, tolerance);
+        this->iterations = iterations;
+        this->threads = max(1, min(threads, max(1, model.numStates())));
+        partition();
+    }
+
+    // evaluates the policy starting from, and leaving the result in, values;
+    // returns the largest change in the last sweep of any range
+    double run(vector<double> &values) {
+        int n = model.numStates();
+        value.reset(new atomic<double>[n]);
+        for (int node=0; node<n; node++) {
+            value[node].store(values[node], memory_order_relaxed);
+        }
+        epochs.reset(new Epoch[threads]);
+        for (int t=0; t<threads; t++) {
+            epochs[t].quietAt.store(-1);
+            epochs[t].residual = 0.0;
+        }
+        changes.store(0);
+        done.store(false);
+
+        vector<thread> workers;
+        for (int t=1; t<threads; t++) {
+            workers.push_back(thread(&AsyncValueIteration::work, this, t));
+        }
+        work(0);
+        for (thread& worker: workers) {
+            worker.join();
+        }
+
+        double residual = 0.0;
+        for (int node=0; node<n; node++) {
+            values[node] = load(node);
+        }
+        for (int t=0; t<threads; t++) {
+            residual = max(residual, epochs[t].residual);
+        }
+        return residual;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_ASYNCVALUEITERATION_H
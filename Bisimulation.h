@@ -0,0 +1,251 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_BISIMULATION_H
+#define MARKOVPROCESSSOLVER_BISIMULATION_H
+
+#include "CompiledModel.h"
+#include "vector"
+#include "algorithm"
+
+using namespace std;
+
+// The coarsest probabilistic bisimulation of a compiled model: states of the
+// same kind and reward (and decision probability) whose successors fall into
+// the same blocks, counted per block for decision nodes and summed by weight
+// per block for chance nodes. Bisimilar states have the same optimal value,
+// so the solver can work on one state per block.
+//
+// Found by partition refinement from the split by kind and reward: a block
+// is re-split whenever a successor of one of its states moved to a new block,
+// the largest part keeping the block's id, until no block splits any more.
+class Bisimulation {
+
+private:
+    const CompiledModel &model;
+    vector<int> predecessorOffset, predecessor;
+
+    // the successor blocks of node with their edge counts (decision) or summed
+    // weights (chance), ordered by block
+    void signature(int node, vector<pair<int, double>> &sig) {
+        sig.clear();
+        for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+            double amount = model.kind[node] == CompiledModel::CHANCE ? model.weight[e] : 1.0;
+            sig.push_back(make_pair(block[model.target[e]], amount));
+        }
+        sort(sig.begin(), sig.end());
+        int kept = 0;
+        for (int i=0; i<sig.size(); i++) {
+            if (kept > 0 && sig[kept-1].first == sig[i].first) {
+                sig[kept-1].second += sig[i].second;
+            } else {
+                sig[kept++] = sig[i];
+            }
+        }
+        sig.resize(kept);
+    }
+
+    // splits block b by signature; marks the blocks of predecessors of moved states dirty
+    void split(int b, vector<char> &dirty, vector<int> &nextDirty) {
+        vector<int> states = members[b];
+        vector<vector<pair<int, double>>> sigs(states.size());
+        vector<int> order(states.size());
+        for (int i=0; i<states.size(); i++) {
+            signature(states[i], sigs[i]);
+            order[i] = i;
+        }
+        stable_sort(order.begin(), order.end(), [&sigs](int x, int y) {
+            return sigs[x] < sigs[y];
+        });
+
+        vector<vector<int>> groups;
+        for (int i=0; i<order.size(); i++) {
+            if (i == 0 || sigs[order[i]] != sigs[order[i-1]]) {
+                groups.push_back(vector<int>());
+            }
+            groups.back().push_back(states[order[i]]);
+        }
+        if (groups.size() == 1) {
+            return;
+        }
+
+        int largest = 0;
+        for (int g=1; g<groups.size(); g++) {
+            if (groups[g].size() > groups[largest].size()) {
+                largest = g;
+            }
+        }
+        for (int g=0; g<groups.size(); g++) {
+            if (g == largest) {
+                continue;
+            }
+            for (int state: groups[g]) {
+                block[state] = members.size();
+            }
+            sort(groups[g].begin(), groups[g].end());
+            members.push_back(groups[g]);
+            dirty.push_back(false);
+        }
+        sort(groups[largest].begin(), groups[largest].end());
+        members[b] = groups[largest];
+
+        // only once every moved state has its new block, as a predecessor may
+        // itself have moved
+        for (int g=0; g<groups.size(); g++) {
+            if (g == largest) {
+                continue;
+            }
+            for (int state: groups[g]) {
+                for (int e=predecessorOffset[state]; e<predecessorOffset[state+1]; e++) {
+                    int dependent = block[predecessor[e]];
+                    if (!dirty[dependent]) {
+                        dirty[dependent] = true;
+                        nextDirty.push_back(dependent);
+                    }
+                }
+            }
+        }
+    }
+
+public:
+    // block of every state, and the states of every block in id order
+    vector<int> block;
+    vector<vector<int>> members;
+    int rounds;
+
+    Bisimulation(const CompiledModel &model) : model(model) {
+        int n = model.numStates();
+        model.predecessors(predecessorOffset, predecessor);
+
+        vector<int> order(n);
+        for (int i=0; i<n; i++) {
+            order[i] = i;
+        }
+        auto key = [&model](int s) {
+            return make_pair(make_pair((int) model.kind[s], model.reward[s]), model.decisionProb[s]);
+        };
+        stable_sort(order.begin(), order.end(), [&key](int x, int y) {
+            return key(x) < key(y);
+        });
+        block.assign(n, 0);
+        for (int i=0; i<n; i++) {
+            if (i == 0 || key(order[i]) != key(order[i-1])) {
+                members.push_back(vector<int>());
+            }
+            block[order[i]] = members.size() - 1;
+            members.back().push_back(order[i]);
+        }
+        for (vector<int>& states: members) {
+            sort(states.begin(), states.end());
+        }
+
+        vector<char> dirty(members.size(), true);
+        vector<int> current, next;
+        for (int b=0; b<members.size(); b++) {
+            current.push_back(b);
+        }
+        rounds = 0;
+        while (!current.empty()) {
+            rounds++;
+            for (int b: current) {
+                dirty[b] = false;
+            }
+            for (int b: current) {
+                split(b, dirty, next);
+            }
+            current.swap(next);
+            next.clear();
+        }
+    }
+
+    int blocks() const {
+        return members.size();
+    }
+
+    // The model over the states kept per block: as many of a block's states
+    // as a decision node has neighbors in it, so every neighbor of a kept
+    // decision node can still be a distinct state. A decision node's edges
+    // go to the kept states of their blocks in turn, a chance node gets one
+    // edge per successor block with the summed weight. keptState[b] lists
+    // the quotient ids of block b's kept states.
+    CompiledModel quotient(vector<vector<int>> &keptState) {
+        int n = model.numStates();
+        vector<int> needed(blocks(), 1);
+        vector<pair<int, double>> sig;
+        for (int b=0; b<blocks(); b++) {
+            int node = members[b][0];
+            if (model.kind[node] == CompiledModel::DECISION) {
+                signature(node, sig);
+                for (const pair<int, double>& successor: sig) {
+                    needed[successor.first] = max(needed[successor.first], (int) successor.second);
+                }
+            }
+        }
+
+        vector<bool> keep(n, false);
+        for (int b=0; b<blocks(); b++) {
+            for (int i=0; i<needed[b]; i++) {
+                keep[members[b][i]] = true;
+            }
+        }
+        vector<int> quotientId(n, -1);
+        int kept = 0;
+        for (int s=0; s<n; s++) {
+            if (keep[s]) {
+                quotientId[s] = kept++;
+            }
+        }
+        keptState.assign(blocks(), vector<int>());
+        for (int b=0; b<blocks(); b++) {
+            for (int i=0; i<needed[b]; i++) {
+                keptState[b].push_back(quotientId[members[b][i]]);
+            }
+        }
+
+        CompiledModel q;
+        q.offset.push_back(0);
+        vector<int> used(blocks(), 0);
+        for (int s=0; s<n; s++) {
+            if (!keep[s]) {
+                continue;
+            }
+            q.names.push_back(model.names[s]);
+            q.reward.push_back(model.reward[s]);
+            q.kind.push_back(model.kind[s]);
+            q.decisionProb.push_back(model.decisionProb[s]);
+            if (model.kind[s] == CompiledModel::DECISION) {
+                for (int e=model.offset[s]; e<model.offset[s+1]; e++) {
+                    int b = block[model.target[e]];
+                    q.target.push_back(keptState[b][used[b]++]);
+                    q.weight.push_back(0.0);
+                }
+                for (int e=model.offset[s]; e<model.offset[s+1]; e++) {
+                    used[block[model.target[e]]] = 0;
+                }
+            } else if (model.kind[s] == CompiledModel::CHANCE) {
+                signature(s, sig);
+                // successor blocks in the order the node first reaches them
+                for (int e=model.offset[s]; e<model.offset[s+1]; e++) {
+                    int b = block[model.target[e]];
+                    if (used[b]++ == 0) {
+                        q.target.push_back(keptState[b][0]);
+                        q.weight.push_back(lower_bound(sig.begin(), sig.end(), make_pair(b, -1e300))->second);
+                    }
+                }
+                for (int e=model.offset[s]; e<model.offset[s+1]; e++) {
+                    used[block[model.target[e]]] = 0;
+                }
+            }
+            q.offset.push_back(q.target.size());
+        }
+        for (int s: model.byName) {
+            if (keep[s]) {
+                q.byName.push_back(quotientId[s]);
+            }
+        }
+        return q;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_BISIMULATION_H
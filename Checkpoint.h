@@ -0,0 +1,143 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_CHECKPOINT_H
+#define MARKOVPROCESSSOLVER_CHECKPOINT_H
+
+#include "vector"
+#include "string"
+#include "thread"
+#include "mutex"
+#include "condition_variable"
+#include "iostream"
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Everything needed to continue policy iteration where it stopped: the
+// values and policies after `sweep` sweeps of policy round `round`, plus the
+// max residual of every sweep so far.
+struct Checkpoint {
+    int numStates, round, sweep;
+    unsigned long long fingerprint;
+    vector<double> value;
+    vector<int> policy;
+    vector<double> residuals;
+
+    // Reads the header first and stops there when the checkpoint was taken
+    // on a model other than the one of numStates states with the given
+    // fingerprint, which the caller finds in the header fields; nothing is
+    // allocated from the counts of a foreign or corrupt file.
+    static bool load(const string &path, int numStates, unsigned long long fingerprint, int maxResiduals, Checkpoint &checkpoint) {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+
+        char magic[4];
+        int residualCount = 0;
+        bool ok = fread(magic, 1, 4, file) == 4 && string(magic, 4) == "MPSC" &&
+                  fread(&checkpoint.numStates, sizeof(int), 1, file) == 1 &&
+                  fread(&checkpoint.fingerprint, sizeof(unsigned long long), 1, file) == 1 &&
+                  fread(&checkpoint.round, sizeof(int), 1, file) == 1 &&
+                  fread(&checkpoint.sweep, sizeof(int), 1, file) == 1 &&
+                  fread(&residualCount, sizeof(int), 1, file) == 1 &&
+                  residualCount >= 0 && residualCount <= maxResiduals;
+        if (ok && checkpoint.numStates == numStates && checkpoint.fingerprint == fingerprint) {
+            checkpoint.value.resize(checkpoint.numStates);
+            checkpoint.policy.resize(checkpoint.numStates);
+            checkpoint.residuals.resize(residualCount);
+            ok = fread(checkpoint.value.data(), sizeof(double), checkpoint.numStates, file) == checkpoint.numStates &&
+                 fread(checkpoint.policy.data(), sizeof(int), checkpoint.numStates, file) == checkpoint.numStates &&
+                 fread(checkpoint.residuals.data(), sizeof(double), residualCount, file) == residualCount;
+        }
+        fclose(file);
+        return ok;
+    }
+
+    // writes next to the target and renames over it, so a crash mid-write
+    // leaves the previous checkpoint intact
+    bool save(const string &path) const {
+        string temporary = path + ".tmp";
+        FILE *file = fopen(temporary.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+
+        int residualCount = residuals.size();
+        bool ok = fwrite("MPSC", 1, 4, file) == 4 &&
+                  fwrite(&numStates, sizeof(int), 1, file) == 1 &&
+                  fwrite(&fingerprint, sizeof(unsigned long long), 1, file) == 1 &&
+                  fwrite(&round, sizeof(int), 1, file) == 1 &&
+                  fwrite(&sweep, sizeof(int), 1, file) == 1 &&
+                  fwrite(&residualCount, sizeof(int), 1, file) == 1 &&
+                  fwrite(value.data(), sizeof(double), numStates, file) == numStates &&
+                  fwrite(policy.data(), sizeof(int), numStates, file) == numStates &&
+                  fwrite(residuals.data(), sizeof(double), residualCount, file) == residualCount;
+        ok = fflush(file) == 0 && ok;
+        ok = fsync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+        return ok && rename(temporary.c_str(), path.c_str()) == 0;
+    }
+};
+
+// Saves checkpoints on a background thread so the solver only pays for
+// copying its vectors into a snapshot. If the disk falls behind, a newer
+// snapshot replaces the one still waiting to be written.
+class CheckpointWriter {
+private:
+    string path;
+    Checkpoint pending;
+    bool hasPending, stopped;
+    mutex lock;
+    condition_variable changed;
+    thread writer;
+
+    void run() {
+        Checkpoint snapshot;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [this] { return stopped || hasPending; });
+                if (!hasPending) {
+                    return;
+                }
+                swap(snapshot, pending);
+                hasPending = false;
+            }
+            if (!snapshot.save(path)) {
+                cout<<"Could not write checkpoint: "<<path<<endl;
+            }
+        }
+    }
+
+public:
+    CheckpointWriter(string path) {
+        this->path = path;
+        this->hasPending = false;
+        this->stopped = false;
+        writer = thread(&CheckpointWriter::run, this);
+    }
+
+    // takes the snapshot's contents; the caller's vectors are left for reuse
+    void submit(Checkpoint &snapshot) {
+        unique_lock<mutex> guard(lock);
+        swap(pending, snapshot);
+        hasPending = true;
+        changed.notify_all();
+    }
+
+    // writes whatever is still pending before returning
+    ~CheckpointWriter() {
+        {
+            unique_lock<mutex> guard(lock);
+            stopped = true;
+            changed.notify_all();
+        }
+        writer.join();
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_CHECKPOINT_H
@@ -0,0 +1,254 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_COMPILEDMODEL_H
+#define MARKOVPROCESSSOLVER_COMPILEDMODEL_H
+
+#include "vector"
+#include "algorithm"
+#include "unordered_map"
+#include "string"
+
+using namespace std;
+
+// The parsed model with node names interned to dense state ids. Ids follow
+// name order, so iterating states by id visits them in the same order as the
+// original std::map did, unless reorder() renumbered them; byName always lists
+// the ids in name order. Edges are stored in CSR form: the neighbors of state
+// s are target[offset[s]] .. target[offset[s+1]-1], in input order.
+struct CompiledModel {
+    enum Kind : unsigned char { TERMINAL, DECISION, CHANCE };
+
+    vector<string> names;
+    vector<double> reward;
+    vector<unsigned char> kind;
+    vector<double> decisionProb;
+    vector<int> offset;
+    vector<int> target;
+    vector<double> weight;
+    vector<int> byName;
+
+    int numStates() const {
+        return names.size();
+    }
+
+    int degree(int state) const {
+        return offset[state+1] - offset[state];
+    }
+
+    // state id of a node name, or -1 when the model has no such node
+    int find(const string &name) const {
+        auto itr = lower_bound(byName.begin(), byName.end(), name, [this](int state, const string &key) {
+            return names[state] < key;
+        });
+        if (itr == byName.end() || names[*itr] != name) {
+            return -1;
+        }
+        return *itr;
+    }
+
+    // the reverse edges in CSR form: the states with an edge to s are
+    // predecessor[predecessorOffset[s]] .. predecessor[predecessorOffset[s+1]-1]
+    void predecessors(vector<int> &predecessorOffset, vector<int> &predecessor) const {
+        int n = numStates();
+        predecessorOffset.assign(n + 1, 0);
+        predecessor.resize(target.size());
+        for (int e=0; e<target.size(); e++) {
+            predecessorOffset[target[e] + 1]++;
+        }
+        for (int s=0; s<n; s++) {
+            predecessorOffset[s+1] += predecessorOffset[s];
+        }
+        vector<int> fillAt(predecessorOffset.begin(), predecessorOffset.end() - 1);
+        for (int node=0; node<n; node++) {
+            for (int e=offset[node]; e<offset[node+1]; e++) {
+                predecessor[fillAt[target[e]]++] = node;
+            }
+        }
+    }
+
+    // renumbers the states so that state i becomes what was state newToOld[i];
+    // every node keeps its edges in input order
+    void reorder(const vector<int> &newToOld) {
+        int n = numStates();
+        vector<int> oldToNew(n);
+        for (int i=0; i<n; i++) {
+            oldToNew[newToOld[i]] = i;
+        }
+
+        CompiledModel reordered;
+        reordered.offset.push_back(0);
+        for (int i=0; i<n; i++) {
+            int old = newToOld[i];
+            reordered.names.push_back(names[old]);
+            reordered.reward.push_back(reward[old]);
+            reordered.kind.push_back(kind[old]);
+            reordered.decisionProb.push_back(decisionProb[old]);
+            for (int e=offset[old]; e<offset[old+1]; e++) {
+                reordered.target.push_back(oldToNew[target[e]]);
+                reordered.weight.push_back(weight[e]);
+            }
+            reordered.offset.push_back(reordered.target.size());
+        }
+        for (int i=0; i<n; i++) {
+            reordered.byName.push_back(oldToNew[byName[i]]);
+        }
+        swap(*this, reordered);
+    }
+
+    // the states reachable from starts by following edges, starts included
+    vector<bool> reachableFrom(const vector<int> &starts) const {
+        vector<bool> reached(numStates(), false);
+        vector<int> stack;
+        for (int start: starts) {
+            if (!reached[start]) {
+                reached[start] = true;
+                stack.push_back(start);
+            }
+        }
+        while (!stack.empty()) {
+            int state = stack.back();
+            stack.pop_back();
+            for (int e=offset[state]; e<offset[state+1]; e++) {
+                if (!reached[target[e]]) {
+                    reached[target[e]] = true;
+                    stack.push_back(target[e]);
+                }
+            }
+        }
+        return reached;
+    }
+
+    // drops the states not marked in keep, which no kept state may have an
+    // edge to; the kept states stay in their current order
+    void restrict(const vector<bool> &keep) {
+        int n = numStates();
+        vector<int> oldToNew(n, -1), newToOld;
+        for (int i=0; i<n; i++) {
+            if (keep[i]) {
+                oldToNew[i] = newToOld.size();
+                newToOld.push_back(i);
+            }
+        }
+
+        CompiledModel kept;
+        kept.offset.push_back(0);
+        for (int old: newToOld) {
+            kept.names.push_back(names[old]);
+            kept.reward.push_back(reward[old]);
+            kept.kind.push_back(kind[old]);
+            kept.decisionProb.push_back(decisionProb[old]);
+            for (int e=offset[old]; e<offset[old+1]; e++) {
+                kept.target.push_back(oldToNew[target[e]]);
+                kept.weight.push_back(weight[e]);
+            }
+            kept.offset.push_back(kept.target.size());
+        }
+        for (int old: byName) {
+            if (keep[old]) {
+                kept.byName.push_back(oldToNew[old]);
+            }
+        }
+        swap(*this, kept);
+    }
+
+    // FNV-1a over names, transitions, probabilities and rewards, to tell whether
+    // saved state belongs to this model
+    unsigned long long fingerprint() const {
+        unsigned long long hash = 14695981039346656037ULL;
+        auto mix = [&hash](const void *data, size_t bytes) {
+            const unsigned char *at = (const unsigned char*) data;
+            for (size_t i=0; i<bytes; i++) {
+                hash = (hash ^ at[i])*1099511628211ULL;
+            }
+        };
+        for (const string& name: names) {
+            mix(name.c_str(), name.size() + 1);
+        }
+        mix(kind.data(), kind.size());
+        mix(offset.data(), offset.size()*sizeof(int));
+        mix(target.data(), target.size()*sizeof(int));
+        mix(weight.data(), weight.size()*sizeof(double));
+        mix(decisionProb.data(), decisionProb.size()*sizeof(double));
+        mix(reward.data(), reward.size()*sizeof(double));
+        return hash;
+    }
+
+    static CompiledModel compile(const unordered_map<string, vector<string>> &adj,
+                                 const unordered_map<string, vector<double>> &prob,
+                                 const unordered_map<string, double> &reward) {
+        CompiledModel model;
+
+        // every node with a reward, with edges, or reached by an edge is a state
+        for (auto itr = reward.begin(); itr!=reward.end(); itr++) {
+            model.names.push_back(itr->first);
+        }
+        for (auto itr = adj.begin(); itr!=adj.end(); itr++) {
+            if (!itr->second.empty()) {
+                model.names.push_back(itr->first);
+            }
+            for (const string& neighbor: itr->second) {
+                model.names.push_back(neighbor);
+            }
+        }
+        sort(model.names.begin(), model.names.end());
+        model.names.erase(unique(model.names.begin(), model.names.end()), model.names.end());
+        model.names.shrink_to_fit();
+        model.byName.reserve(model.numStates());
+        for (int i=0; i<model.numStates(); i++) {
+            model.byName.push_back(i);
+        }
+
+        unordered_map<string, int> id;
+        for (int i=0; i<model.numStates(); i++) {
+            id[model.names[i]] = i;
+        }
+
+        // exact sizes up front, so no vector carries spare capacity
+        int n = model.numStates();
+        size_t edges = 0;
+        for (auto itr = adj.begin(); itr!=adj.end(); itr++) {
+            edges += itr->second.size();
+        }
+        model.reward.reserve(n);
+        model.kind.reserve(n);
+        model.decisionProb.reserve(n);
+        model.offset.reserve(n + 1);
+        model.target.reserve(edges);
+        model.weight.reserve(edges);
+
+        model.offset.push_back(0);
+        for (const string& node: model.names) {
+            auto r = reward.find(node);
+            model.reward.push_back(r == reward.end() ? 0.0 : r->second);
+
+            auto a = adj.find(node);
+            auto p = prob.find(node);
+            vector<double> probabilities = p == prob.end() ? vector<double>() : p->second;
+            if (a == adj.end() || a->second.empty()) {
+                model.kind.push_back(TERMINAL);
+                model.decisionProb.push_back(0.0);
+            } else if (probabilities.size() > 1) {
+                model.kind.push_back(CHANCE);
+                model.decisionProb.push_back(0.0);
+            } else {
+                model.kind.push_back(DECISION);
+                model.decisionProb.push_back(probabilities.empty() ? 1.0 : probabilities[0]);
+            }
+
+            if (a != adj.end()) {
+                for (int e=0; e<a->second.size(); e++) {
+                    model.target.push_back(id[a->second[e]]);
+                    bool weighted = model.kind.back() == CHANCE && e < probabilities.size();
+                    model.weight.push_back(weighted ? probabilities[e] : 0.0);
+                }
+            }
+            model.offset.push_back(model.target.size());
+        }
+
+        return model;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_COMPILEDMODEL_H
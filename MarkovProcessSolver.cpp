@@ -3,6 +3,8 @@
 //
 
 #include "MarkovProcessSolver.h"
+#include "OutOfCoreSolver.h"
+#include "SolverDaemon.h"
 
 using namespace std;
 
@@ -15,7 +17,12 @@ void readCommandLineArguments(int argc, char *argv[], ProgramArguments *argument
             arguments->maximise = false;
         } else if (arg == "-df") {
             if (i+1<argc) {
-                arguments->discountFactor = stod(argv[i+1]);
+                // a comma separated list solves with each of them at once
+                arguments->discountFactors.clear();
+                for (const string& df: MarkovProcessSolver::split(argv[i+1], ',')) {
+                    arguments->discountFactors.push_back(stod(df));
+                }
+                arguments->discountFactor = arguments->discountFactors[0];
             }
         } else if (arg == "-tol") {
             if (i+1<argc) {
@@ -25,6 +32,104 @@ void readCommandLineArguments(int argc, char *argv[], ProgramArguments *argument
             if (i+1<argc) {
                 arguments->iterations = stoi(argv[i+1]);
             }
+        } else if (arg == "-ooc") {
+            if (i+1<argc) {
+                arguments->outOfCore = true;
+                arguments->blockFile = argv[++i];
+            }
+        } else if (arg == "-procs") {
+            if (i+1<argc) {
+                arguments->processes = max(1, stoi(argv[i+1]));
+            }
+        } else if (arg == "-checkpoint") {
+            if (i+1<argc) {
+                arguments->checkpointFile = argv[++i];
+            }
+        } else if (arg == "-checkpoint-interval") {
+            if (i+1<argc) {
+                arguments->checkpointInterval = stod(argv[i+1]);
+            }
+        } else if (arg == "--warm-start") {
+            if (i+1<argc) {
+                arguments->warmStartFile = argv[++i];
+            }
+        } else if (arg == "-daemon") {
+            arguments->daemon = true;
+        } else if (arg == "-socket") {
+            if (i+1<argc) {
+                arguments->daemon = true;
+                arguments->socketPath = argv[++i];
+            }
+        } else if (arg == "-cache") {
+            if (i+1<argc) {
+                arguments->cacheDirectory = argv[++i];
+            }
+        } else if (arg == "-cache-limit") {
+            if (i+1<argc) {
+                arguments->cacheLimitMB = stod(argv[i+1]);
+            }
+        } else if (arg == "--resume") {
+            arguments->resume = true;
+        } else if (arg == "-threads") {
+            if (i+1<argc) {
+                arguments->threads = max(1, stoi(argv[i+1]));
+            }
+        } else if (arg == "-async") {
+            arguments->asynchronous = true;
+        } else if (arg == "-deterministic") {
+            arguments->deterministic = true;
+        } else if (arg == "-fused") {
+            arguments->fused = true;
+        } else if (arg == "-eliminate") {
+            arguments->actionElimination = true;
+        } else if (arg == "-worklist") {
+            arguments->worklist = true;
+        } else if (arg == "-multigrid") {
+            arguments->multigrid = true;
+        } else if (arg == "--mem-report") {
+            arguments->memoryReport = true;
+        } else if (arg == "--mem-budget") {
+            if (i+1<argc) {
+                arguments->memoryBudgetMB = stod(argv[i+1]);
+            }
+        } else if (arg == "--progress") {
+            if (i+1<argc) {
+                arguments->progressInterval = stod(argv[i+1]);
+            }
+        } else if (arg == "--residual-trace") {
+            if (i+1<argc) {
+                arguments->residualTraceFile = argv[++i];
+            }
+        } else if (arg == "-rewards") {
+            if (i+1<argc) {
+                arguments->rewardScenarioFile = argv[++i];
+            }
+        } else if (arg == "-simulate") {
+            if (i+1<argc) {
+                arguments->simulatedTrajectories = stoll(argv[i+1]);
+            }
+        } else if (arg == "-simulate-from") {
+            if (i+1<argc) {
+                arguments->simulateFrom = argv[++i];
+            }
+        } else if (arg == "-sensitivity") {
+            if (i+1<argc) {
+                arguments->sensitivityOf = argv[++i];
+            }
+        } else if (arg == "-start") {
+            if (i+1<argc) {
+                arguments->startStates = argv[++i];
+            }
+        } else if (arg == "-quotient") {
+            arguments->quotient = true;
+        } else if (arg == "-order") {
+            if (i+1<argc) {
+                arguments->ordering = argv[i+1];
+            }
+        } else if (arg == "-block") {
+            if (i+1<argc) {
+                arguments->blockStates = max(1, stoi(argv[i+1]));
+            }
         }
         else if (arg.length() >= inputFileExtension.length() &&
                    arg.substr(arg.length() - inputFileExtension.length()) == inputFileExtension) {
@@ -37,6 +142,25 @@ int main(int argc, char *argv[]) {
     ProgramArguments *arguments = new ProgramArguments();
     readCommandLineArguments(argc, argv, arguments);
 
+    if (arguments->daemon) {
+        SolverDaemon daemon;
+        if (!arguments->inputFile.empty()) {
+            daemon.preload(arguments->inputFile, arguments->inputFile);
+        }
+        if (arguments->socketPath.empty()) {
+            daemon.serve();
+        } else {
+            daemon.serve(arguments->socketPath);
+        }
+        return 0;
+    }
+
+    if (arguments->outOfCore) {
+        OutOfCoreSolver *solver = new OutOfCoreSolver(arguments);
+        solver->solve();
+        return 0;
+    }
+
     MarkovProcessSolver *solver = new MarkovProcessSolver(arguments);
     solver->solve();
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include "vector"
 #include "algorithm"
+#include "numeric"
 #include "unordered_map"
 #include "map"
 #include <stdio.h>
@@ -15,14 +16,40 @@
 #include "fstream"
 #include "sstream"
 #include "iostream"
+#include "CompiledModel.h"
+#include "PartitionedSolver.h"
+#include "Checkpoint.h"
+#include "ModelCache.h"
+#include "WorkStealingScheduler.h"
+#include "AsyncValueIteration.h"
+#include "StateOrdering.h"
+#include "PolicyKernels.h"
+#include "AggregationMultigrid.h"
+#include "MemoryReport.h"
+#include "SolveObserver.h"
+#include "MultiLaneSolver.h"
+#include "PolicySimulator.h"
+#include "RewardSensitivity.h"
+#include "Bisimulation.h"
+#include "chrono"
+#include <math.h>
 
 using namespace std;
 
+// blocks a -deterministic sweep is cut into, enough to keep a few chunks per
+// thread on machines of up to 16 cores
+const int DETERMINISTIC_BLOCKS = 64;
+
+// sweep residuals kept for checkpoints; older ones are dropped
+const int RESIDUAL_HISTORY = 1000;
+
 struct ProgramArguments {
-    string inputFile;
-    double discountFactor, tolerance;
-    int iterations;
-    bool maximise;
+    string inputFile, blockFile, checkpointFile, warmStartFile, socketPath, cacheDirectory, ordering, residualTraceFile, rewardScenarioFile, simulateFrom, sensitivityOf, startStates;
+    double discountFactor, tolerance, checkpointInterval, cacheLimitMB, memoryBudgetMB, progressInterval;
+    vector<double> discountFactors;
+    long long simulatedTrajectories;
+    int iterations, blockStates, processes, threads;
+    bool maximise, outOfCore, resume, daemon, asynchronous, fused, actionElimination, worklist, multigrid, memoryReport, quotient, deterministic;
 
     ProgramArguments() {
         discountFactor = 1.0;
@@ -30,6 +57,36 @@ struct ProgramArguments {
         maximise = true;
         iterations = 100;
         inputFile = "";
+        outOfCore = false;
+        blockFile = "";
+        blockStates = 65536;
+        processes = 1;
+        threads = 1;
+        asynchronous = false;
+        fused = false;
+        actionElimination = false;
+        worklist = false;
+        multigrid = false;
+        memoryReport = false;
+        memoryBudgetMB = 0;
+        progressInterval = 0;
+        residualTraceFile = "";
+        rewardScenarioFile = "";
+        simulatedTrajectories = 0;
+        simulateFrom = "";
+        sensitivityOf = "";
+        startStates = "";
+        quotient = false;
+        deterministic = false;
+        checkpointFile = "";
+        checkpointInterval = 60.0;
+        resume = false;
+        warmStartFile = "";
+        daemon = false;
+        socketPath = "";
+        cacheDirectory = "";
+        cacheLimitMB = 1024;
+        ordering = "name";
     }
 };
 
@@ -39,209 +96,1074 @@ private:
     unordered_map<string, vector<string>> adj;
     unordered_map<string, vector<double>> prob;
     unordered_map<string, double> reward;
-    map<string, double> value;
-    map<string, string> policy;
-    unordered_map<string, bool> decisionNode;
+    CompiledModel model;
+    vector<double> value, nextValue;
+    vector<int> policy;
+    vector<double> residuals;
+    unsigned long long fingerprint;
+    bool fingerprintStale;
+    vector<int> changedStates;
+    vector<int> runEnd;
+    int round, sweep;
     double discountFactor;
-    int iterations;
+    int iterations, processes;
     double tolerance;
-    bool maximise, correctInputFormat;
+    bool maximise, correctInputFormat, asynchronous, fused, deterministic;
+    bool improvedDuringSweep;
+    int policyChangesDuringSweep;
+    bool actionElimination, worklist, multigrid, memoryReport;
+    int threads;
+    vector<pair<string, long long>> loadingBytes;
+    bool overBudget;
+    vector<int> predecessorOffset, predecessor;
+    vector<int> candidateTarget, candidateEnd;
+    vector<double> lowerBound, upperBound;
+    long long actions, eliminatedActions;
+    string checkpointFile;
+    double checkpointInterval;
+    CheckpointWriter *checkpointWriter;
+    Checkpoint snapshot;
+    chrono::steady_clock::time_point lastCheckpoint;
+    shared_ptr<WorkStealingScheduler> scheduler;
+    vector<pair<int, int>> chunks;
+    // with -deterministic, the fixed blocks that sweeps update in place
+    vector<pair<int, int>> blocks;
+    vector<shared_ptr<SolveObserver>> observers;
+    vector<double> scenarioRewards, discountFactors;
+    int scenarios;
+    long long simulatedTrajectories;
+    string simulateFrom, sensitivityOf;
+    // with -quotient the solve runs on the quotient; these map it back
+    CompiledModel fullModel;
+    vector<int> stateBlock, quotientBlock, blockState;
+    bool onQuotient;
 
     void init() {
+        model = CompiledModel::compile(adj, prob, reward);
+        if (memoryReport) {
+            loadingBytes.push_back(make_pair("parsed adj", MemoryReport::bytesOf(adj)));
+            loadingBytes.push_back(make_pair("parsed prob", MemoryReport::bytesOf(prob)));
+            loadingBytes.push_back(make_pair("parsed reward", MemoryReport::bytesOf(reward)));
+        }
 
-        //mark decision nodes
-        for (auto itr = prob.begin(); itr!=prob.end(); itr++) {
-            string node = itr->first;
-            if (itr->second.size() == 1) {
-                decisionNode[node] = true;
+        // the compiled model replaces the parsed maps from here on
+        unordered_map<string, vector<string>>().swap(adj);
+        unordered_map<string, vector<double>>().swap(prob);
+        unordered_map<string, double>().swap(reward);
+    }
+
+    // keeps only the states reachable from the named ones, so the solve skips the rest
+    void pruneUnreachable(const string &startStates) {
+        vector<int> starts;
+        for (const string& name: split(startStates, ',')) {
+            int node = model.find(name);
+            if (node < 0) {
+                cout<<"Unknown start node "<<name<<endl;
+            } else {
+                starts.push_back(node);
             }
         }
+        if (starts.empty()) {
+            cout<<"No known start nodes, solving the whole model"<<endl;
+            return;
+        }
 
-        // assign initial values to nodes
-        for (auto itr = reward.begin(); itr!= reward.end(); itr++) {
-            string node = itr->first;
-            if (adj[node].empty()) {
-                value[node] = reward[node];
+        vector<bool> reachable = model.reachableFrom(starts);
+        int n = model.numStates();
+        int pruned = n - count(reachable.begin(), reachable.end(), true);
+        if (pruned > 0) {
+            model.restrict(reachable);
+        }
+        cout<<"Pruned "<<pruned<<" of "<<n<<" states unreachable from the start nodes"<<endl;
+    }
+
+    // Replaces the model by its bisimulation quotient, remembering the full
+    // model and which block every state belongs to for expandQuotient.
+    void buildQuotient() {
+        for (int node=0; node<model.numStates(); node++) {
+            if (model.kind[node] != CompiledModel::DECISION) {
+                continue;
+            }
+            vector<int> neighbors(model.target.begin() + model.offset[node], model.target.begin() + model.offset[node+1]);
+            sort(neighbors.begin(), neighbors.end());
+            if (adjacent_find(neighbors.begin(), neighbors.end()) != neighbors.end()) {
+                cout<<"Cannot build the quotient: "<<model.names[node]<<" lists a neighbor twice, solving the whole model"<<endl;
+                return;
             }
         }
 
-        for (auto itr = adj.begin(); itr!=adj.end(); itr++) {
-            string node = itr->first;
-            if (!adj[node].empty() and prob.find(node)==prob.end()) {
-                prob[node] = vector<double> {1.0};
-                decisionNode[node] = true;
+        Bisimulation bisimulation(model);
+        vector<vector<int>> keptState;
+        CompiledModel quotient = bisimulation.quotient(keptState);
+        cout<<"Merged "<<model.numStates()<<" states into "<<quotient.numStates()<<" ("<<bisimulation.blocks()
+            <<" blocks, "<<bisimulation.rounds<<" refinement rounds)"<<endl;
+
+        stateBlock = bisimulation.block;
+        blockState.resize(keptState.size());
+        quotientBlock.resize(quotient.numStates());
+        for (int b=0; b<keptState.size(); b++) {
+            blockState[b] = keptState[b][0];
+            for (int q: keptState[b]) {
+                quotientBlock[q] = b;
             }
         }
+        swap(fullModel, model);
+        swap(model, quotient);
+        onQuotient = true;
+    }
+
+    // Puts the full model back with every state's value and policy taken
+    // from its block: a decision node chooses its first neighbor in the
+    // block its block's quotient state chose.
+    void expandQuotient() {
+        int n = fullModel.numStates();
+        vector<double> fullValue(n);
+        vector<int> fullPolicy(n, -1);
+        for (int node=0; node<n; node++) {
+            int q = blockState[stateBlock[node]];
+            fullValue[node] = value[q];
+            if (fullModel.kind[node] != CompiledModel::DECISION || policy[q] < 0) {
+                continue;
+            }
+            int chosenBlock = quotientBlock[policy[q]];
+            for (int e=fullModel.offset[node]; e<fullModel.offset[node+1]; e++) {
+                if (stateBlock[fullModel.target[e]] == chosenBlock) {
+                    fullPolicy[node] = fullModel.target[e];
+                    break;
+                }
+            }
+        }
+        swap(model, fullModel);
+        fingerprintStale = true;
+        fullModel = CompiledModel();
+        value.swap(fullValue);
+        policy.swap(fullPolicy);
+        onQuotient = false;
+    }
+
+    // renumber states for locality; lookups and printing still go by name
+    void reorderStates(const string &ordering) {
+        if (ordering == "bfs") {
+            model.reorder(StateOrdering::breadthFirst(model));
+        } else if (ordering == "rcm") {
+            model.reorder(StateOrdering::reverseCuthillMcKee(model));
+        } else if (ordering == "kind") {
+            model.reorder(StateOrdering::byKind(model));
+        } else if (ordering != "name") {
+            cout<<"Unknown state order "<<ordering<<", keeping name order"<<endl;
+        }
+    }
+
+    void initValuesAndPolicies() {
+        int n = model.numStates();
+        if (scheduler) {
+            // a few chunks per thread leaves room for stealing on heavy-tailed degrees
+            chunks = WorkStealingScheduler::chunksByCost(model.offset, 8*scheduler->size());
+        }
+        if (deterministic) {
+            blocks = WorkStealingScheduler::chunksByCost(model.offset, DETERMINISTIC_BLOCKS);
+        }
 
-        for (auto itr = adj.begin(); itr!=adj.end(); itr++) {
-            string node = itr->first;
-            if (!adj[node].empty() and value.find(node)==value.end()) {
-                value[node] = 0.0;
+        // assign initial values to nodes
+        value.assign(n, 0.0);
+        for (int node=0; node<n; node++) {
+            if (model.kind[node] == CompiledModel::TERMINAL) {
+                value[node] = model.reward[node];
             }
         }
 
         // assign initial policies based on neighbor with most reward
-        for (auto itr = decisionNode.begin(); itr!=decisionNode.end(); itr++) {
-            string node = itr->first;
-            string greedyNeighbor;
-            double greedyNeighborReward;
-            if (maximise) {
-                greedyNeighborReward = -DBL_MAX;
-                for (auto itr1 = adj[node].begin(); itr1!=adj[node].end(); itr1++) {
-                    string neighbor = *itr1;
-                    if (reward[neighbor] > greedyNeighborReward) {
-                        greedyNeighborReward = reward[neighbor];
-                        greedyNeighbor = neighbor;
-                    }
+        policy.assign(n, -1);
+        forEachChunk([this](int begin, int end, int) {
+            for (int node=begin; node<end; node++) {
+                if (model.kind[node] == CompiledModel::DECISION) {
+                    policy[node] = greedyNeighbor(node, model.reward);
+                }
+            }
+        });
+
+        if (actionElimination) {
+            // every decision node starts with all of its neighbors as candidate actions
+            candidateTarget = model.target;
+            candidateEnd.assign(model.offset.begin() + 1, model.offset.end());
+            lowerBound.assign(n, -HUGE_VAL);
+            upperBound.assign(n, HUGE_VAL);
+            actions = 0;
+            eliminatedActions = 0;
+            for (int node=0; node<n; node++) {
+                if (model.kind[node] == CompiledModel::DECISION) {
+                    actions += model.degree(node);
+                } else if (model.kind[node] == CompiledModel::TERMINAL) {
+                    lowerBound[node] = model.reward[node];
+                    upperBound[node] = model.reward[node];
                 }
+            }
+        }
+
+        round = 0;
+        sweep = 0;
+    }
+
+    // Reads reward scenarios as lines of "node = r1 r2 ... rK", every line with
+    // the same K; nodes without a line keep their model reward in all of them.
+    void readRewardScenarios(string scenarioFile) {
+        ifstream file(scenarioFile);
+        if (!file) {
+            cout<<"Cannot open reward scenarios: "<<scenarioFile<<endl;
+            correctInputFormat = false;
+            return;
+        }
+
+        vector<pair<int, vector<double>>> lines;
+        scenarios = 0;
+        string line;
+        while (getline(file, line)) {
+            removeLeadingAndTrailingWhitespace(line);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            vector<string> nodeRewards = split(line, '=');
+            int node = nodeRewards.size() == 2 ? model.find(nodeRewards[0]) : -1;
+            vector<double> rewards;
+            stringstream ss(node >= 0 ? nodeRewards[1] : "");
+            string token;
+            while (ss>>token) {
+                rewards.push_back(stod(token));
+            }
+            if (node < 0 || rewards.empty() || (scenarios > 0 && rewards.size() != scenarios)) {
+                correctInputFormat = false;
+                cout<<"Error in line: "<<line<<endl;
+                return;
+            }
+            scenarios = rewards.size();
+            lines.push_back(make_pair(node, rewards));
+        }
+        if (scenarios == 0) {
+            cout<<"No reward scenarios in "<<scenarioFile<<endl;
+            correctInputFormat = false;
+            return;
+        }
+
+        int n = model.numStates();
+        scenarioRewards.resize((size_t) n*scenarios);
+        for (int node=0; node<n; node++) {
+            fill(scenarioRewards.begin() + (size_t) node*scenarios, scenarioRewards.begin() + (size_t) (node+1)*scenarios, model.reward[node]);
+        }
+        for (const pair<int, vector<double>>& rewards: lines) {
+            copy(rewards.second.begin(), rewards.second.end(), scenarioRewards.begin() + (size_t) rewards.first*scenarios);
+        }
+    }
+
+    // Solves every reward scenario with every discount factor together, and
+    // prints each pair like a single solve, discount factors varying fastest.
+    void solveLanes(bool printSolution) {
+        int n = model.numStates();
+        int rewardSets = max(1, scenarios);
+        const vector<double> &baseRewards = scenarios > 0 ? scenarioRewards : model.reward;
+        vector<double> discounts = discountFactors.empty() ? vector<double>(1, discountFactor) : discountFactors;
+        int lanes = rewardSets*discounts.size();
+
+        vector<double> rewards((size_t) n*lanes), laneDiscounts(lanes);
+        for (int lane=0; lane<lanes; lane++) {
+            laneDiscounts[lane] = discounts[lane % discounts.size()];
+            for (int node=0; node<n; node++) {
+                rewards[(size_t) node*lanes + lane] = baseRewards[(size_t) node*rewardSets + lane/discounts.size()];
+            }
+        }
+
+        MultiLaneSolver solver(model, rewards, laneDiscounts, tolerance, iterations, maximise);
+        solver.solve();
+        if (!printSolution) {
+            return;
+        }
+        for (int k=0; k<lanes; k++) {
+            stringstream label;
+            if (scenarios > 0) {
+                label<<"Scenario "<<k/discounts.size()+1<<(discounts.size() > 1 ? ", discount factor " : "");
             } else {
-                greedyNeighborReward = DBL_MAX;
-                for (auto itr1 = adj[node].begin(); itr1!=adj[node].end(); itr1++) {
-                    string neighbor = *itr1;
-                    if (reward[neighbor] < greedyNeighborReward) {
-                        greedyNeighborReward = reward[neighbor];
-                        greedyNeighbor = neighbor;
-                    }
+                label<<"Discount factor ";
+            }
+            if (discounts.size() > 1) {
+                label<<laneDiscounts[k];
+            }
+            cout<<label.str()<<" ("<<solver.roundsOf(k)<<" rounds)"<<endl;
+            for (int node: model.byName) {
+                if (model.kind[node] == CompiledModel::DECISION && model.degree(node)>1) {
+                    cout<<model.names[node]<<" -> "<<model.names[solver.policyOf(node, k)]<<endl;
                 }
             }
 
-            policy[node] = greedyNeighbor;
+            cout<<endl;
+
+            for (int node: model.byName) {
+                cout<<model.names[node]<<"="<<solver.valueOf(node, k)<<" ";
+            }
+            cout<<endl<<endl;
         }
     }
 
-    void greedyPolicyComputation() {
-        // assign  policies based on neighbor with most value
-        for (auto itr = decisionNode.begin(); itr!=decisionNode.end(); itr++) {
-            string node = itr->first;
-            string greedyNeighbor;
-            double greedyNeighborValue;
-            if (maximise) {
-                greedyNeighborValue = -DBL_MAX;
-                for (auto itr1 = adj[node].begin(); itr1!=adj[node].end(); itr1++) {
-                    string neighbor = *itr1;
-                    if (value[neighbor] > greedyNeighborValue) {
-                        greedyNeighborValue = value[neighbor];
-                        greedyNeighbor = neighbor;
-                    }
+    // start from the values and policies printed by an earlier solve, matched by
+    // node name; new nodes and policies that are no longer edges keep init()'s choice
+    void warmStart(string solutionFile) {
+        ifstream file(solutionFile);
+        if (!file) {
+            cout<<"Cannot open warm start solution: "<<solutionFile<<endl;
+            return;
+        }
+
+        string line;
+        int values = 0, policies = 0;
+        while (getline(file, line)) {
+            size_t arrow = line.find(" -> ");
+            if (arrow != string::npos) {
+                int node = model.find(line.substr(0, arrow));
+                int neighbor = model.find(line.substr(arrow + 4));
+                if (node < 0 || neighbor < 0 || model.kind[node] != CompiledModel::DECISION) {
+                    continue;
                 }
-            } else {
-                greedyNeighborValue = DBL_MAX;
-                for (auto itr1 = adj[node].begin(); itr1!=adj[node].end(); itr1++) {
-                    string neighbor = *itr1;
-                    if (value[neighbor] < greedyNeighborValue) {
-                        greedyNeighborValue = value[neighbor];
-                        greedyNeighbor = neighbor;
+                for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                    if (model.target[e] == neighbor) {
+                        policy[node] = neighbor;
+                        policies++;
+                        break;
                     }
                 }
+                continue;
             }
 
-            policy[node] = greedyNeighbor;
+            stringstream ss(line);
+            string token;
+            while (ss>>token) {
+                size_t equals = token.rfind('=');
+                if (equals == string::npos) {
+                    continue;
+                }
+                int node = model.find(token.substr(0, equals));
+                if (node >= 0 && model.kind[node] != CompiledModel::TERMINAL) {
+                    value[node] = stod(token.substr(equals + 1));
+                    values++;
+                }
+            }
         }
+
+        cout<<"Warm start: reused "<<values<<" values and "<<policies<<" policies from "<<solutionFile<<endl;
     }
 
-    void valueIteration() {
-        int i = 0;
-        while (i<iterations) {
-            int count = 0;
-            for (auto itr = value.begin(); itr!=value.end(); itr++) {
-                string node = itr->first;
-                if (adj[node].empty()) {
+    // continue from the last checkpoint, if it was taken on this model
+    void resumeFromCheckpoint() {
+        Checkpoint checkpoint;
+        if (!Checkpoint::load(checkpointFile, model.numStates(), modelFingerprint(), RESIDUAL_HISTORY, checkpoint)) {
+            cout<<"No checkpoint to resume from in "<<checkpointFile<<", starting from the beginning"<<endl;
+            return;
+        }
+        if (checkpoint.numStates != model.numStates() || checkpoint.fingerprint != modelFingerprint()) {
+            cout<<"Checkpoint "<<checkpointFile<<" belongs to a different model, starting from the beginning"<<endl;
+            return;
+        }
+
+        value.swap(checkpoint.value);
+        policy.swap(checkpoint.policy);
+        residuals.swap(checkpoint.residuals);
+        round = checkpoint.round;
+        sweep = checkpoint.sweep;
+    }
+
+    // the model's fingerprint, hashed again only after the model has changed
+    unsigned long long modelFingerprint() {
+        if (fingerprintStale) {
+            fingerprint = model.fingerprint();
+            fingerprintStale = false;
+        }
+        return fingerprint;
+    }
+
+    // hands a copy of the current state to the checkpoint writer once every interval
+    void checkpoint() {
+        if (checkpointWriter == nullptr ||
+            chrono::duration<double>(chrono::steady_clock::now() - lastCheckpoint).count() < checkpointInterval) {
+            return;
+        }
+
+        snapshot.numStates = model.numStates();
+        snapshot.fingerprint = modelFingerprint();
+        snapshot.round = round;
+        snapshot.sweep = sweep;
+        snapshot.value.assign(value.begin(), value.end());
+        snapshot.policy.assign(policy.begin(), policy.end());
+        snapshot.residuals.assign(residuals.end() - min((int) residuals.size(), RESIDUAL_HISTORY), residuals.end());
+        checkpointWriter->submit(snapshot);
+        lastCheckpoint = chrono::steady_clock::now();
+    }
+
+    int greedyNeighbor(int node, const vector<double> &score) {
+        if (maximise) {
+            return greedyTarget<Maximise>(model.target.data(), model.offset[node], model.offset[node+1], score);
+        }
+        return greedyTarget<Minimise>(model.target.data(), model.offset[node], model.offset[node+1], score);
+    }
+
+    // assign policies based on neighbor with most value, returns how many changed
+    int greedyPolicyComputation() {
+        return maximise ? improvePolicy<Maximise>() : improvePolicy<Minimise>();
+    }
+
+    template <class Direction>
+    int improvePolicy() {
+        vector<int> policyChanges(scheduler ? scheduler->size() : 1, 0);
+        forEachChunk([this, &policyChanges](int begin, int end, int thread) {
+            policyChanges[thread] += improvePolicy<Direction>(begin, end);
+        });
+        return accumulate(policyChanges.begin(), policyChanges.end(), 0);
+    }
+
+    template <class Direction>
+    int improvePolicy(int begin, int end) {
+        int policyChanges = 0;
+        forEachRun(begin, end, [this, &policyChanges](CompiledModel::Kind kind, int begin, int end) {
+            if (kind != CompiledModel::DECISION) {
+                return;
+            }
+            for (int node=begin; node<end; node++) {
+                int greedy = greedyAction<Direction>(node);
+                if (greedy != policy[node]) {
+                    policy[node] = greedy;
+                    policyChanges++;
+                }
+            }
+        });
+        return policyChanges;
+    }
+
+    // the greedy neighbor of a decision node among the actions not eliminated yet
+    template <class Direction>
+    int greedyAction(int node) {
+        if (candidateEnd.empty()) {
+            return greedyTarget<Direction>(model.target.data(), model.offset[node], model.offset[node+1], value);
+        }
+        return greedyTarget<Direction>(candidateTarget.data(), model.offset[node], candidateEnd[node], value);
+    }
+
+    // The greedy operator is a discountFactor-contraction, so the solution lies
+    // within ||Tv - v||/(1 - discountFactor) of the current values. Tightens the
+    // per-state bounds with that and permanently drops every action whose
+    // optimistic bound is worse than another action's pessimistic one. Returns
+    // how many nodes had their current choice dropped and had to move.
+    int eliminateActions() {
+        int threads = scheduler ? scheduler->size() : 1;
+        vector<double> threadResiduals(threads, 0.0);
+        forEachChunk([&](int begin, int end, int thread) {
+            for (int node=begin; node<end; node++) {
+                if (model.kind[node] != CompiledModel::TERMINAL) {
+                    threadResiduals[thread] = max(threadResiduals[thread], abs(evaluate(node) - value[node]));
+                }
+            }
+        });
+        double margin = *max_element(threadResiduals.begin(), threadResiduals.end())/(1.0 - discountFactor);
+        for (int node=0; node<model.numStates(); node++) {
+            if (model.kind[node] != CompiledModel::TERMINAL) {
+                lowerBound[node] = max(lowerBound[node], value[node] - margin);
+                upperBound[node] = min(upperBound[node], value[node] + margin);
+            }
+        }
+
+        const vector<double> &pessimistic = maximise ? lowerBound : upperBound;
+        const vector<double> &optimistic = maximise ? upperBound : lowerBound;
+        vector<long long> eliminated(threads, 0);
+        vector<int> policyMoved(threads, 0);
+        forEachChunk([&](int begin, int end, int thread) {
+            for (int node=begin; node<end; node++) {
+                if (model.kind[node] != CompiledModel::DECISION || candidateEnd[node] - model.offset[node] < 2) {
                     continue;
                 }
-                double currentValue = value[node];
-                double newValue = reward[node];
-                bool isDecisionNode = false;
-                if (decisionNode.find(node) != decisionNode.end()) {
-                    isDecisionNode = true;
+                double guaranteed = pessimistic[candidateTarget[model.offset[node]]];
+                for (int e=model.offset[node]; e<candidateEnd[node]; e++) {
+                    guaranteed = maximise ? max(guaranteed, pessimistic[candidateTarget[e]]) : min(guaranteed, pessimistic[candidateTarget[e]]);
                 }
 
-                for (auto itr1 = adj[node].begin(); itr1!=adj[node].end(); itr1++) {
-                    string neighbor = *itr1;
-                    if (isDecisionNode) {
-                        if (neighbor == policy[node]) {
-                            newValue += discountFactor*prob[node][0]*value[neighbor];
-                        } else {
-                            if ((adj[node].size()-1) != 0) {
-                                newValue += (discountFactor*(1.0 - prob[node][0])*value[neighbor])/(adj[node].size() - 1);
-                            }
-                        }
+                int kept = model.offset[node];
+                bool keptPolicy = false;
+                for (int e=model.offset[node]; e<candidateEnd[node]; e++) {
+                    int neighbor = candidateTarget[e];
+                    if (maximise ? optimistic[neighbor] < guaranteed : optimistic[neighbor] > guaranteed) {
+                        eliminated[thread]++;
                     } else {
-                        int index = itr1-adj[node].begin();
-                        newValue += discountFactor*prob[node][index]*value[neighbor];
+                        candidateTarget[kept++] = neighbor;
+                        keptPolicy = keptPolicy || neighbor == policy[node];
                     }
                 }
+                candidateEnd[node] = kept;
+                if (!keptPolicy) {
+                    policy[node] = maximise ? greedyAction<Maximise>(node) : greedyAction<Minimise>(node);
+                    policyMoved[thread]++;
+                }
+            }
+        });
+
+        long long eliminatedNow = 0;
+        for (int t=0; t<threads; t++) {
+            eliminatedNow += eliminated[t];
+        }
+        eliminatedActions += eliminatedNow;
+        cout<<"Round "<<round<<": eliminated "<<eliminatedNow<<" actions, "
+            <<(actions > 0 ? 100.0*eliminatedActions/actions : 0.0)<<"% of "<<actions<<" so far"<<endl;
+        return accumulate(policyMoved.begin(), policyMoved.end(), 0);
+    }
+
+    // runEnd[s] is one past the last state of the run of same-kind states that
+    // holds s, so kernels can be picked once per run rather than once per state
+    void findKindRuns() {
+        int n = model.numStates();
+        runEnd.resize(n);
+        for (int node=n-1; node>=0; node--) {
+            bool sameKind = node+1 < n && model.kind[node+1] == model.kind[node];
+            runEnd[node] = sameKind ? runEnd[node+1] : node+1;
+        }
+    }
+
+    // calls body(kind, runBegin, runEnd) for every run of same-kind states in [begin, end)
+    template <class Body>
+    void forEachRun(int begin, int end, Body body) {
+        for (int node=begin; node<end; ) {
+            int stop = min(end, runEnd[node]);
+            body((CompiledModel::Kind) model.kind[node], node, stop);
+            node = stop;
+        }
+    }
+
+    // runs body(begin, end, thread) over all states: as chunks on the scheduler
+    // when solving with several threads, otherwise as one range on this thread
+    void forEachChunk(const function<void(int, int, int)> &body) {
+        if (scheduler) {
+            scheduler->run(chunks, body);
+        } else {
+            body(0, model.numStates(), 0);
+        }
+    }
+
+    // the value of a non-terminal node under the current policy and neighbor values
+    double evaluate(int node) {
+        if (model.kind[node] == CompiledModel::DECISION) {
+            return evaluate<CompiledModel::DECISION>(node);
+        }
+        return evaluate<CompiledModel::CHANCE>(node);
+    }
+
+    template <CompiledModel::Kind K>
+    double evaluate(int node) {
+        return evaluate<K>(node, [this](int neighbor) {
+            return value[neighbor];
+        });
+    }
+
+    // The same backup for a node known to be of kind K, with neighbor values
+    // taken from read
+    template <CompiledModel::Kind K, class Read>
+    double evaluate(int node, Read read) {
+        int begin = model.offset[node], end = model.offset[node+1];
+        if (K == CompiledModel::DECISION) {
+            return decisionBackup(model.reward[node], model.target.data(), begin, end, policy[node],
+                                  model.decisionProb[node], discountFactor, read);
+        }
+        return chanceBackup(model.reward[node], model.target.data(), model.weight.data(), begin, end, discountFactor, read);
+    }
+
+    // a sweep over a run of decision nodes that also picks each node's greedy
+    // neighbor from the values it has just read, counting policy changes
+    template <class Direction>
+    void sweepAndImprove(int begin, int end, vector<double> &newValues, int &count, double &residual, int &changes) {
+        for (int node=begin; node<end; node++) {
+            double currentValue = value[node];
+            double newValue = evaluate<CompiledModel::DECISION>(node);
+            newValues[node] = newValue;
+            residual = max(residual, abs(newValue - currentValue));
+            if (abs(newValue - currentValue) <= tolerance) {
+                count++;
+            }
+            int greedy = greedyAction<Direction>(node);
+            if (greedy != policy[node]) {
+                policy[node] = greedy;
+                changes++;
+            }
+        }
+    }
+
+    // one sweep over a run of kind K, counting states that moved at most the tolerance
+    template <CompiledModel::Kind K>
+    void sweepRun(int begin, int end, vector<double> &newValues, int &count, double &residual) {
+        sweepRun<K>(begin, end, newValues, count, residual, [this](int neighbor) {
+            return value[neighbor];
+        });
+    }
+
+    template <CompiledModel::Kind K, class Read>
+    void sweepRun(int begin, int end, vector<double> &newValues, int &count, double &residual, Read read) {
+        for (int node=begin; node<end; node++) {
+            double currentValue = value[node];
+            double newValue = evaluate<K>(node, read);
+            newValues[node] = newValue;
+            residual = max(residual, abs(newValue - currentValue));
+            if (abs(newValue - currentValue) <= tolerance) {
+                count++;
+            }
+        }
+    }
+
+    void valueIteration() {
+        int n = model.numStates();
+        int threads = scheduler ? scheduler->size() : 1;
+        findKindRuns();
+        improvedDuringSweep = false;
+        if (asynchronous && threads > 1 && !deterministic) {
+            AsyncValueIteration evaluation(model, policy, discountFactor, tolerance, iterations - sweep, threads);
+            sweepDone(evaluation.run(value));
+            return;
+        }
+
+        if (worklist) {
+            worklistIteration();
+            return;
+        }
+        if (multigrid) {
+            multigridIteration();
+            return;
+        }
+        if (deterministic) {
+            blockIteration();
+            return;
+        }
+
+        vector<int> counts(threads);
+        vector<double> threadResiduals(threads);
+        vector<int> policyChanges(threads);
+
+        // a single thread updates values in place (Gauss-Seidel); several threads
+        // all read the previous sweep's values and write the next ones (Jacobi)
+        vector<double> &newValues = scheduler ? nextValue : value;
+        if (scheduler) {
+            nextValue = value;
+        }
+
+        while (sweep<iterations) {
+            // with -fused the sweep known to be the last one also improves the policy
+            bool improve = fused && sweep == iterations-1;
+            fill(counts.begin(), counts.end(), 0);
+            fill(threadResiduals.begin(), threadResiduals.end(), 0.0);
+            forEachChunk([&](int begin, int end, int thread) {
+                int count = 0;
+                double residual = 0.0;
+                forEachRun(begin, end, [&](CompiledModel::Kind kind, int begin, int end) {
+                    if (kind == CompiledModel::DECISION && improve && maximise) {
+                        sweepAndImprove<Maximise>(begin, end, newValues, count, residual, policyChanges[thread]);
+                    } else if (kind == CompiledModel::DECISION && improve) {
+                        sweepAndImprove<Minimise>(begin, end, newValues, count, residual, policyChanges[thread]);
+                    } else if (kind == CompiledModel::DECISION) {
+                        sweepRun<CompiledModel::DECISION>(begin, end, newValues, count, residual);
+                    } else if (kind == CompiledModel::CHANCE) {
+                        sweepRun<CompiledModel::CHANCE>(begin, end, newValues, count, residual);
+                    }
+                });
+                counts[thread] += count;
+                threadResiduals[thread] = max(threadResiduals[thread], residual);
+            });
+            if (scheduler) {
+                value.swap(nextValue);
+            }
+
+            int count = 0;
+            double residual = 0.0;
+            for (int t=0; t<threads; t++) {
+                count += counts[t];
+                residual = max(residual, threadResiduals[t]);
+            }
+            sweepDone(residual);
+            if (improve) {
+                improvedDuringSweep = true;
+                policyChangesDuringSweep = accumulate(policyChanges.begin(), policyChanges.end(), 0);
+            }
+            if (count == n) {
+                break;
+            }
+            sweep++;
+            checkpoint();
+        }
+    }
+
+    // Sweeps for -deterministic. The states are cut into the same fixed blocks
+    // whatever the number of threads; a block is swept Gauss-Seidel in place,
+    // reading its own states' latest values and everyone else's from the end
+    // of the previous sweep. No value then depends on which thread swept a
+    // block or when, so values, sweep counts and policies are bit-identical
+    // for any thread count, while most neighbors, being in the same block
+    // after reordering, are still read fresh.
+    void blockIteration() {
+        int n = model.numStates();
+        int threads = scheduler ? scheduler->size() : 1;
+        vector<int> counts(threads);
+        vector<double> threadResiduals(threads);
 
-                value[node] = newValue;
-                if (abs(newValue - currentValue) <= tolerance) {
-                    count++;
+        while (sweep<iterations) {
+            nextValue = value;
+            fill(counts.begin(), counts.end(), 0);
+            fill(threadResiduals.begin(), threadResiduals.end(), 0.0);
+            function<void(int, int, int)> body = [&](int blockBegin, int blockEnd, int thread) {
+                const double *fresh = value.data(), *previous = nextValue.data();
+                unsigned size = blockEnd - blockBegin;
+                auto read = [fresh, previous, blockBegin, size](int neighbor) {
+                    return ((unsigned) (neighbor - blockBegin) < size ? fresh : previous)[neighbor];
+                };
+                int count = 0;
+                double residual = 0.0;
+                forEachRun(blockBegin, blockEnd, [&](CompiledModel::Kind kind, int begin, int end) {
+                    if (kind == CompiledModel::DECISION) {
+                        sweepRun<CompiledModel::DECISION>(begin, end, value, count, residual, read);
+                    } else if (kind == CompiledModel::CHANCE) {
+                        sweepRun<CompiledModel::CHANCE>(begin, end, value, count, residual, read);
+                    }
+                });
+                counts[thread] += count;
+                threadResiduals[thread] = max(threadResiduals[thread], residual);
+            };
+            if (scheduler) {
+                scheduler->run(blocks, body);
+            } else {
+                for (const pair<int, int>& block: blocks) {
+                    body(block.first, block.second, 0);
                 }
             }
-            if (count == value.size()) {
+
+            // integer sums and a maximum, so the order threads finished in does not matter
+            int count = accumulate(counts.begin(), counts.end(), 0);
+            double residual = *max_element(threadResiduals.begin(), threadResiduals.end());
+            sweepDone(residual);
+            if (count == n) {
                 break;
             }
-            i++;
+            sweep++;
+            checkpoint();
         }
     }
 
-    map<string, string> createCopy(map<string, string> m) {
-        vector<string> keys, values;
+    // Gauss-Seidel sweeps over an active set: the first sweep of a round visits
+    // every state, later ones only the predecessors of states that moved by
+    // more than the tolerance, so a sweep costs about as much as the active set.
+    // The next set is collected while sweeping and deduplicated with a bitset.
+    void worklistIteration() {
+        int n = model.numStates();
+        if (predecessorOffset.empty()) {
+            model.predecessors(predecessorOffset, predecessor);
+        }
 
-        for (auto itr = m.begin(); itr!=m.end(); itr++) {
-            keys.push_back(itr->first);
-            values.push_back(itr->second);
+        vector<int> active, next;
+        vector<bool> queued(n, false);
+        for (int node=0; node<n; node++) {
+            if (model.kind[node] != CompiledModel::TERMINAL) {
+                active.push_back(node);
+            }
         }
 
-        map<string, string> mnew;
+        // a state is left out only while none of its neighbors moved by more
+        // than drop, which keeps the values within the tolerance
+        double drop = settledChange(discountFactor, tolerance);
+        while (sweep<iterations) {
+            double residual = 0.0;
+            for (int node: active) {
+                double currentValue = value[node];
+                value[node] = evaluate(node);
+                double change = abs(value[node] - currentValue);
+                residual = max(residual, change);
+                if (change <= drop) {
+                    continue;
+                }
+                for (int e=predecessorOffset[node]; e<predecessorOffset[node+1]; e++) {
+                    int dependent = predecessor[e];
+                    if (!queued[dependent] && model.kind[dependent] != CompiledModel::TERMINAL) {
+                        queued[dependent] = true;
+                        next.push_back(dependent);
+                    }
+                }
+            }
 
-        for (int i=0; i<keys.size(); i++) {
-            mnew[keys[i]] = values[i];
+            // visit the next set in state order, as a full sweep would
+            sort(next.begin(), next.end());
+            for (int node: next) {
+                queued[node] = false;
+            }
+            active.swap(next);
+            next.clear();
+
+            sweepDone(residual);
+            if (active.empty()) {
+                break;
+            }
+            sweep++;
+            checkpoint();
         }
+    }
+
+    // Policy evaluation by multigrid-preconditioned corrections of the
+    // residual, until the residual is within the tolerance. Each correction
+    // counts as one sweep against the iteration limit.
+    void multigridIteration() {
+        int n = model.numStates();
+        AggregationMultigrid accelerator(model, policy, discountFactor);
+        vector<double> residual(n, 0.0);
+        // the same bound on the distance to the fixed point as -worklist and -async
+        double settled = settledChange(discountFactor, tolerance);
+
+        while (sweep<iterations) {
+            double largest = 0.0;
+            for (int node=0; node<n; node++) {
+                if (model.kind[node] != CompiledModel::TERMINAL) {
+                    residual[node] = evaluate(node) - value[node];
+                    largest = max(largest, abs(residual[node]));
+                }
+            }
+            sweepDone(largest);
+            if (largest <= settled) {
+                break;
+            }
 
-        return mnew;
+            vector<double> change = accelerator.correction(residual);
+            for (int node=0; node<n; node++) {
+                value[node] += change[node];
+            }
+            sweep++;
+            checkpoint();
+        }
     }
 
-    bool isEquals(map<string, string> m1, map<string, string> m2) {
-        if (m1.size()!=m2.size()) {
-            return false;
+    // records the residual of the sweep just finished, keeping the latest
+    // RESIDUAL_HISTORY, and tells the observers, if any
+    void sweepDone(double residual) {
+        residuals.push_back(residual);
+        if (residuals.size() >= 2*RESIDUAL_HISTORY) {
+            residuals.erase(residuals.begin(), residuals.end() - RESIDUAL_HISTORY);
+        }
+        for (const shared_ptr<SolveObserver>& observer: observers) {
+            observer->sweepDone(round, sweep, residual);
         }
+    }
 
-        for (auto itr = m1.begin(); itr!=m1.end(); itr++) {
-            string node = itr->first;
-            if (m1[node]!=m2[node]) {
-                return false;
-            }
+    // The compiled model and solver state as allocated now, plus what the
+    // chosen modes will allocate once the solve starts.
+    MemoryReport memoryUse() {
+        long long n = model.numStates(), edges = model.target.size();
+        MemoryReport report(n, edges);
+        for (const pair<string, long long>& loading: loadingBytes) {
+            report.add(loading.first, loading.second, false, MemoryReport::WHILE_LOADING);
+        }
+        report.add("names", MemoryReport::bytesOf(model.names) + MemoryReport::bytesOf(model.byName));
+        report.add("reward", MemoryReport::bytesOf(model.reward));
+        report.add("kind", MemoryReport::bytesOf(model.kind));
+        report.add("decisionProb", MemoryReport::bytesOf(model.decisionProb));
+        report.add("offset", MemoryReport::bytesOf(model.offset));
+        report.add("target", MemoryReport::bytesOf(model.target), true);
+        report.add("weight", MemoryReport::bytesOf(model.weight), true);
+        report.add("value", MemoryReport::bytesOf(value));
+        report.add("policy", MemoryReport::bytesOf(policy));
+        if (actionElimination) {
+            report.add("candidate actions", MemoryReport::bytesOf(candidateTarget) + MemoryReport::bytesOf(candidateEnd), true);
+            report.add("value bounds", MemoryReport::bytesOf(lowerBound) + MemoryReport::bytesOf(upperBound));
         }
 
-        return true;
+        if (!scenarioRewards.empty()) {
+            report.add("reward scenarios", MemoryReport::bytesOf(scenarioRewards));
+        }
+
+        if (!scenarioRewards.empty() || discountFactors.size() > 1) {
+            // every lane's reward in solveLanes and in the solver, the live and
+            // the final values and policies, and the smaller block a retirement
+            // rebuilds next to them
+            long long lanes = max(1, scenarios)*max<long long>(1, discountFactors.size());
+            report.add("lane rewards", 2*n*lanes*sizeof(double), false, MemoryReport::DURING_SOLVE);
+            report.add("lane values", 2*n*lanes*sizeof(double), false, MemoryReport::DURING_SOLVE);
+            report.add("lane policies", 2*n*lanes*sizeof(int), false, MemoryReport::DURING_SOLVE);
+            report.add("retired lanes", n*(lanes - 1)*(2*sizeof(double) + sizeof(int)), false, MemoryReport::DURING_SOLVE);
+            return report;
+        }
+
+        report.add("kind runs", n*sizeof(int), false, MemoryReport::DURING_SOLVE);
+        if (threads > 1 && asynchronous) {
+            report.add("asynchronous values", n*sizeof(atomic<double>), false, MemoryReport::DURING_SOLVE);
+        } else if (threads > 1 || deterministic) {
+            report.add("next values", n*sizeof(double), false, MemoryReport::DURING_SOLVE);
+        }
+        if (worklist) {
+            report.add("reverse index", (n + 1 + edges)*sizeof(int), true, MemoryReport::DURING_SOLVE);
+            report.add("worklists", n*(2*sizeof(int)) + n/8, false, MemoryReport::DURING_SOLVE);
+        }
+        if (multigrid) {
+            // the finest matrix and about half as much again for the coarser
+            // levels, plus the residual, cycle vectors and GCR directions
+            long long matrix = (n + edges)*(sizeof(int) + sizeof(double)) + n*(sizeof(int) + sizeof(double));
+            report.add("multigrid levels", matrix*3/2, true, MemoryReport::DURING_SOLVE);
+            report.add("multigrid vectors", n*sizeof(double)*(6 + 2*10), false, MemoryReport::DURING_SOLVE);
+        }
+        if (simulatedTrajectories > 0) {
+            long long starts = simulateFrom.empty() ? n - count(model.kind.begin(), model.kind.end(), CompiledModel::TERMINAL)
+                                                    : split(simulateFrom, ',').size();
+            report.add("alias tables", PolicySimulator::bytesFor(model, starts, simulatedTrajectories), true, MemoryReport::DURING_SOLVE);
+        }
+        return report;
     }
 
     void printPolicyAndValues() {
-        for (auto itr = policy.begin(); itr!= policy.end(); itr++) {
-            if (adj[itr->first].size()>1) {
-                cout<<itr->first<<" -> "<<itr->second<<endl;
+        for (int node: model.byName) {
+            if (model.kind[node] == CompiledModel::DECISION && model.degree(node)>1) {
+                cout<<model.names[node]<<" -> "<<model.names[policy[node]]<<endl;
             }
         }
 
         cout<<endl;
 
-        for (auto itr = value.begin(); itr!=value.end(); itr++) {
-            cout<<itr->first<<"="<<itr->second<<" ";
+        for (int node: model.byName) {
+            cout<<model.names[node]<<"="<<value[node]<<" ";
+        }
+    }
+
+    // Rolls out the solved policy from the -simulate-from states, or from every
+    // non-terminal state, and compares the estimates with the solved values.
+    void simulatePolicy() {
+        vector<int> starts;
+        if (simulateFrom.empty()) {
+            for (int node: model.byName) {
+                if (model.kind[node] != CompiledModel::TERMINAL) {
+                    starts.push_back(node);
+                }
+            }
+        } else {
+            for (const string& name: split(simulateFrom, ',')) {
+                int node = model.find(name);
+                if (node < 0) {
+                    cout<<"Cannot simulate from unknown node "<<name<<endl;
+                } else {
+                    starts.push_back(node);
+                }
+            }
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        PolicySimulator simulator(model, policy, discountFactor, 100000, 1);
+        vector<PolicySimulator::Estimate> estimates = simulator.run(starts, simulatedTrajectories, scheduler.get());
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout<<"Simulated "<<simulatedTrajectories<<" trajectories from each of "<<starts.size()<<" states in "
+            <<seconds<<" s ("<<simulatedTrajectories*starts.size()/max(seconds, 1e-9)<<" trajectories/s)"<<endl;
+        int outside = 0;
+        long long cutOff = 0;
+        for (const PolicySimulator::Estimate& estimate: estimates) {
+            double solved = value[estimate.state];
+            bool inside = abs(solved - estimate.mean) <= estimate.halfWidth;
+            outside += !inside;
+            cutOff += estimate.cutOff;
+            cout<<model.names[estimate.state]<<": simulated="<<estimate.mean<<" +- "<<estimate.halfWidth
+                <<" solved="<<solved<<(inside ? "" : " (outside)")<<endl;
+        }
+        cout<<outside<<" of "<<estimates.size()<<" solved values lie outside the 95% confidence interval"<<endl;
+        if (cutOff > 0) {
+            cout<<cutOff<<" trajectories reached the horizon before stopping"<<endl;
+        }
+    }
+
+    // for each -sensitivity state, the rewards its value depends on most
+    void printSensitivities() {
+        const int shown = 20;
+        for (const string& name: split(sensitivityOf, ',')) {
+            vector<pair<string, double>> gradient;
+            if (!rewardSensitivity(name, gradient)) {
+                cout<<"Cannot compute the sensitivity of unknown node "<<name<<endl;
+                continue;
+            }
+            sort(gradient.begin(), gradient.end(), [](const pair<string, double> &a, const pair<string, double> &b) {
+                return abs(a.second) > abs(b.second);
+            });
+            int nonZero = count_if(gradient.begin(), gradient.end(), [](const pair<string, double> &g) {
+                return g.second != 0.0;
+            });
+            cout<<"Sensitivity of "<<name<<" to the rewards of "<<nonZero<<" nodes:"<<endl;
+            for (int i=0; i<min(nonZero, shown); i++) {
+                cout<<"  "<<gradient[i].first<<" "<<gradient[i].second<<endl;
+            }
+            if (nonZero > shown) {
+                cout<<"  ("<<nonZero - shown<<" more)"<<endl;
+            }
         }
     }
 
     void markovProcessSolver() {
-        int i = 0;
-        while (1) {
-            i++;
-            map<string, string> oldPolicy = createCopy(policy);
-            valueIteration();
-            greedyPolicyComputation();
-            if (isEquals(oldPolicy, policy)) {
-                break;
+        if (processes > 1) {
+            SocketTransport transport(processes);
+            PartitionedSolver partitionedSolver(model, &transport, discountFactor, iterations, tolerance, maximise);
+            if (partitionedSolver.solve(value, policy)) {
+                return;
             }
+            cout<<"Partitioned solve failed, continuing in a single process"<<endl;
+        }
+
+        if (!checkpointFile.empty()) {
+            checkpointWriter = new CheckpointWriter(checkpointFile);
+            lastCheckpoint = chrono::steady_clock::now();
         }
 
-        printPolicyAndValues();
+        int policyChanges;
+        do {
+            valueIteration();
+            // a fused last sweep has done the improvement already, otherwise it needs its own pass
+            policyChanges = improvedDuringSweep ? policyChangesDuringSweep : greedyPolicyComputation();
+            if (actionElimination && !candidateEnd.empty()) {
+                policyChanges += eliminateActions();
+            }
+            for (const shared_ptr<SolveObserver>& observer: observers) {
+                observer->roundDone(round, policyChanges);
+            }
+            round++;
+            sweep = 0;
+        } while (policyChanges > 0);
+
+        delete checkpointWriter;
+        checkpointWriter = nullptr;
+    }
+
+    void configure(ProgramArguments *arguments) {
+        this->tolerance = arguments->tolerance;
+        this->iterations = arguments->iterations;
+        this->maximise = arguments->maximise;
+        this->discountFactor = arguments->discountFactor;
+        this->processes = arguments->processes;
+        this->checkpointFile = arguments->checkpointFile;
+        this->checkpointInterval = arguments->checkpointInterval;
+        this->checkpointWriter = nullptr;
+        this->asynchronous = arguments->asynchronous;
+        this->fused = arguments->fused;
+        this->deterministic = arguments->deterministic;
+        this->actionElimination = arguments->actionElimination;
+        this->worklist = arguments->worklist;
+        this->multigrid = arguments->multigrid;
+        this->memoryReport = arguments->memoryReport;
+        this->threads = arguments->threads;
+        this->overBudget = false;
+        this->scenarios = 0;
+        this->discountFactors = arguments->discountFactors;
+        this->simulatedTrajectories = arguments->simulatedTrajectories;
+        this->simulateFrom = arguments->simulateFrom;
+        this->sensitivityOf = arguments->sensitivityOf;
+        this->onQuotient = false;
+        this->fingerprintStale = true;
+        if (actionElimination && discountFactor >= 1.0) {
+            cout<<"Action elimination needs a discount factor below 1, solving without it"<<endl;
+            this->actionElimination = false;
+        }
+        this->improvedDuringSweep = false;
+        if (arguments->threads > 1) {
+            this->scheduler = make_shared<WorkStealingScheduler>(arguments->threads);
+        }
+        if (arguments->progressInterval > 0) {
+            addObserver(make_shared<ProgressPrinter>(arguments->progressInterval));
+        }
+        if (!arguments->residualTraceFile.empty()) {
+            addObserver(make_shared<ResidualTrace>(arguments->residualTraceFile));
+        }
     }
 
     void readFile(string inputFile) {
@@ -303,6 +1225,7 @@ private:
         }
     }
 
+public:
     static vector<string> split(string input, char del) {
         stringstream ss(input);
         string token;
@@ -326,25 +1249,358 @@ private:
         }
     }
 
-public:
     MarkovProcessSolver(ProgramArguments *arguments) {
-        this->tolerance = arguments->tolerance;
-        this->iterations = arguments->iterations;
-        this->maximise = arguments->maximise;
-        this->discountFactor = arguments->discountFactor;
-        readFile(arguments->inputFile);
-        // initialise policies and rewards
+        configure(arguments);
+        string cacheKey;
+        ModelCache cache(arguments->cacheDirectory, arguments->cacheLimitMB*1024*1024);
+        if (!arguments->cacheDirectory.empty()) {
+            cacheKey = cache.key(arguments->inputFile);
+        }
+
+        if (!cacheKey.empty() && cache.load(cacheKey, model)) {
+            correctInputFormat = true;
+        } else {
+            readFile(arguments->inputFile);
+            if (correctInputFormat) {
+                init();
+                if (!cacheKey.empty()) {
+                    cache.store(cacheKey, model);
+                }
+            }
+        }
+
         if (correctInputFormat) {
-            init();
+            // initialise policies and rewards
+            if (!arguments->startStates.empty()) {
+                pruneUnreachable(arguments->startStates);
+            }
+            reorderStates(arguments->ordering);
+            if (arguments->quotient && (!arguments->rewardScenarioFile.empty() || arguments->discountFactors.size() > 1)) {
+                cout<<"The quotient does not apply to several rewards or discount factors, solving the whole model"<<endl;
+            } else if (arguments->quotient) {
+                buildQuotient();
+            }
+            if (!checkpointFile.empty()) {
+                // hashed once here rather than on the solve thread at the first checkpoint
+                modelFingerprint();
+            }
+            initValuesAndPolicies();
+
+            if (!arguments->rewardScenarioFile.empty()) {
+                readRewardScenarios(arguments->rewardScenarioFile);
+            }
+            if (memoryReport || arguments->memoryBudgetMB > 0) {
+                MemoryReport report = memoryUse();
+                if (memoryReport) {
+                    report.print();
+                }
+                double projectedMB = report.total()/(1024.0*1024.0);
+                if (arguments->memoryBudgetMB > 0 && projectedMB > arguments->memoryBudgetMB) {
+                    cout<<"Projected memory of "<<projectedMB<<" MB exceeds the budget of "
+                        <<arguments->memoryBudgetMB<<" MB, not solving"<<endl;
+                    correctInputFormat = false;
+                    overBudget = true;
+                    return;
+                }
+            }
+            if (!arguments->warmStartFile.empty()) {
+                warmStart(arguments->warmStartFile);
+            }
+            if (arguments->resume && checkpointFile.empty()) {
+                cout<<"--resume needs a checkpoint file given with -checkpoint, starting from the beginning"<<endl;
+            } else if (arguments->resume) {
+                resumeFromCheckpoint();
+            }
         }
     }
 
-    void solve() {
+    // a fresh, unsolved copy of an already loaded model that solves with other arguments
+    MarkovProcessSolver(const MarkovProcessSolver &loaded, ProgramArguments *arguments) {
+        configure(arguments);
+        correctInputFormat = loaded.correctInputFormat;
+        model = loaded.model;
+        if (loaded.onQuotient) {
+            fullModel = loaded.fullModel;
+            stateBlock = loaded.stateBlock;
+            quotientBlock = loaded.quotientBlock;
+            blockState = loaded.blockState;
+            onQuotient = true;
+        }
         if (correctInputFormat) {
+            initValuesAndPolicies();
+        }
+    }
+
+    bool hasValidInput() {
+        return correctInputFormat;
+    }
+
+    // the total that --mem-report projects for the loaded model and chosen modes
+    long long projectedBytes() {
+        return memoryUse().total();
+    }
+
+    int numStates() {
+        return model.numStates();
+    }
+
+    // observer is told about every sweep and round of the following solves
+    void addObserver(const shared_ptr<SolveObserver> &observer) {
+        observers.push_back(observer);
+    }
+
+    void solve(bool printSolution = true) {
+        if (correctInputFormat && (!scenarioRewards.empty() || discountFactors.size() > 1)) {
+            solveLanes(printSolution);
+        } else if (correctInputFormat) {
             markovProcessSolver();
-        } else {
+            if (onQuotient) {
+                expandQuotient();
+            }
+            changedStates.clear();
+            if (printSolution) {
+                printPolicyAndValues();
+            }
+            if (simulatedTrajectories > 0) {
+                cout<<endl<<endl;
+                simulatePolicy();
+            }
+            if (!sensitivityOf.empty()) {
+                cout<<endl<<endl;
+                printSensitivities();
+            }
+        } else if (!overBudget) {
             cout<<"Cannot run markov process solver as input file format is not correct"<<endl;
         }
+        if (correctInputFormat && memoryReport) {
+            cout<<endl<<"Peak resident memory: "<<MemoryReport::peakResidentBytes()<<" bytes"<<endl;
+        }
+    }
+
+    // Edits of a loaded model. Each returns false and leaves the model alone
+    // when a node is unknown or the edit would make the model invalid; call
+    // resolve() afterwards to bring values and policies up to date.
+
+    bool setReward(const string &name, double newReward) {
+        int node = model.find(name);
+        if (node < 0) {
+            return false;
+        }
+        model.reward[node] = newReward;
+        if (model.kind[node] == CompiledModel::TERMINAL) {
+            value[node] = newReward;
+        }
+        edited(node);
+        return true;
+    }
+
+    // one probability makes the node a decision node, one per edge (summing to
+    // 1) makes it a chance node, as on a '%' line of the input file
+    bool setProbability(const string &name, const vector<double> &probabilities) {
+        int node = model.find(name);
+        if (node < 0 || probabilities.empty() || model.kind[node] == CompiledModel::TERMINAL) {
+            return false;
+        }
+
+        double ps = 0.0;
+        for (double pr: probabilities) {
+            ps += pr;
+        }
+        if (probabilities.size()>1 and (ps!=1.0 or probabilities.size()!=model.degree(node))) {
+            return false;
+        }
+
+        if (probabilities.size() == 1) {
+            if (model.kind[node] != CompiledModel::DECISION) {
+                model.kind[node] = CompiledModel::DECISION;
+                policy[node] = greedyNeighbor(node, value);
+            }
+            model.decisionProb[node] = probabilities[0];
+            fill(model.weight.begin() + model.offset[node], model.weight.begin() + model.offset[node+1], 0.0);
+        } else {
+            model.kind[node] = CompiledModel::CHANCE;
+            model.decisionProb[node] = 0.0;
+            copy(probabilities.begin(), probabilities.end(), model.weight.begin() + model.offset[node]);
+            policy[node] = -1;
+        }
+        edited(node);
+        return true;
+    }
+
+    // a new edge of a chance node has probability 0 until setProbability is
+    // called, so the node's probabilities still sum to 1
+    bool addEdge(const string &name, const string &neighborName) {
+        int node = model.find(name), neighbor = model.find(neighborName);
+        if (node < 0 || neighbor < 0) {
+            return false;
+        }
+
+        int at = model.offset[node+1];
+        model.target.insert(model.target.begin() + at, neighbor);
+        model.weight.insert(model.weight.begin() + at, 0.0);
+        for (int s=node+1; s<=model.numStates(); s++) {
+            model.offset[s]++;
+        }
+        if (model.kind[node] == CompiledModel::TERMINAL) {
+            model.kind[node] = CompiledModel::DECISION;
+            model.decisionProb[node] = 1.0;
+            policy[node] = neighbor;
+        }
+        edited(node);
+        return true;
+    }
+
+    bool removeEdge(const string &name, const string &neighborName) {
+        int node = model.find(name), neighbor = model.find(neighborName);
+        if (node < 0 || neighbor < 0) {
+            return false;
+        }
+
+        int at = find(model.target.begin() + model.offset[node], model.target.begin() + model.offset[node+1], neighbor) - model.target.begin();
+        if (at == model.offset[node+1]) {
+            return false;
+        }
+        // the other edges of a chance node share the removed edge's probability
+        // in proportion; they cannot when it had all of it
+        double rest = 1.0 - model.weight[at];
+        if (model.kind[node] == CompiledModel::CHANCE && model.degree(node) > 1) {
+            if (rest <= 0.0) {
+                return false;
+            }
+            for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                model.weight[e] /= rest;
+            }
+        }
+        model.target.erase(model.target.begin() + at);
+        model.weight.erase(model.weight.begin() + at);
+        for (int s=node+1; s<=model.numStates(); s++) {
+            model.offset[s]--;
+        }
+
+        if (model.degree(node) == 0) {
+            model.kind[node] = CompiledModel::TERMINAL;
+            model.decisionProb[node] = 0.0;
+            value[node] = model.reward[node];
+            policy[node] = -1;
+        } else if (model.kind[node] == CompiledModel::DECISION && policy[node] == neighbor) {
+            policy[node] = greedyNeighbor(node, value);
+        }
+        edited(node);
+        return true;
+    }
+
+    // value bounds, eliminated actions and the reverse index do not survive an edit of the model
+    void edited(int node) {
+        changedStates.push_back(node);
+        fingerprintStale = true;
+        candidateTarget.clear();
+        candidateEnd.clear();
+        predecessorOffset.clear();
+        predecessor.clear();
+    }
+
+    // Policy iteration restricted to the edited states and everything that can
+    // reach them, starting from the current values and policies. No other
+    // state's value depends on an edit, so the rest of the model is left as is.
+    void resolve() {
+        int n = model.numStates();
+        if (predecessorOffset.empty()) {
+            model.predecessors(predecessorOffset, predecessor);
+        }
+
+        vector<bool> affected(n, false);
+        vector<int> queue;
+        for (int node: changedStates) {
+            if (!affected[node]) {
+                affected[node] = true;
+                queue.push_back(node);
+            }
+        }
+        for (int i=0; i<queue.size(); i++) {
+            for (int e=predecessorOffset[queue[i]]; e<predecessorOffset[queue[i]+1]; e++) {
+                if (!affected[predecessor[e]]) {
+                    affected[predecessor[e]] = true;
+                    queue.push_back(predecessor[e]);
+                }
+            }
+        }
+        changedStates.clear();
+
+        // the affected states as runs of consecutive states, swept in state
+        // order like valueIteration does
+        findKindRuns();
+        vector<pair<int, int>> spans;
+        int unaffected = 0;
+        for (int node=0; node<n; node++) {
+            if (!affected[node]) {
+                unaffected += model.kind[node] != CompiledModel::TERMINAL;
+            } else if (spans.empty() || spans.back().second != node) {
+                spans.push_back(make_pair(node, node+1));
+            } else {
+                spans.back().second++;
+            }
+        }
+
+        // same stopping rule as valueIteration, the untouched states counting
+        // as converged, so the result matches a full re-solve
+        int policyChanges;
+        do {
+            for (int i=0; i<iterations; i++) {
+                int count = unaffected;
+                double residual = 0.0;
+                for (const pair<int, int> &span: spans) {
+                    forEachRun(span.first, span.second, [&](CompiledModel::Kind kind, int begin, int end) {
+                        if (kind == CompiledModel::DECISION) {
+                            sweepRun<CompiledModel::DECISION>(begin, end, value, count, residual);
+                        } else if (kind == CompiledModel::CHANCE) {
+                            sweepRun<CompiledModel::CHANCE>(begin, end, value, count, residual);
+                        }
+                    });
+                }
+                if (count == n) {
+                    break;
+                }
+            }
+
+            policyChanges = 0;
+            for (const pair<int, int> &span: spans) {
+                policyChanges += maximise ? improvePolicy<Maximise>(span.first, span.second)
+                                          : improvePolicy<Minimise>(span.first, span.second);
+            }
+        } while (policyChanges > 0);
+    }
+
+    // value of a node after the last solve or resolve, NaN for unknown nodes
+    double valueOf(const string &name) {
+        int node = model.find(name);
+        return node < 0 ? NAN : value[node];
+    }
+
+    // The derivative of a node's value with respect to every node's reward under
+    // the current policy, by node name in name order; false for unknown nodes.
+    // Solves the adjoint system to the solver's tolerance, about the cost of
+    // one policy evaluation.
+    bool rewardSensitivity(const string &name, vector<pair<string, double>> &gradient) {
+        int node = model.find(name);
+        if (node < 0) {
+            return false;
+        }
+        RewardSensitivity sensitivity(model, policy, discountFactor);
+        vector<double> g = sensitivity.gradient(node, tolerance, iterations);
+        gradient.clear();
+        for (int s: model.byName) {
+            gradient.push_back(make_pair(model.names[s], g[s]));
+        }
+        return true;
+    }
+
+    // chosen neighbor of a decision node, empty for other or unknown nodes
+    string policyOf(const string &name) {
+        int node = model.find(name);
+        if (node < 0 || model.kind[node] != CompiledModel::DECISION || policy[node] < 0) {
+            return "";
+        }
+        return model.names[policy[node]];
     }
 };
 
@@ -0,0 +1,109 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+// Projects the memory of a fixed grid model under each solve mode, as
+// --mem-report does, and prints it per state. Any mode that grew by more
+// than a tenth over the bytes per state recorded below is reported and the
+// exit status is 1, so a regression in the data layout is caught.
+//
+//   MemoryBenchmark [grid side]
+
+#include "MarkovProcessSolver.h"
+#include "iostream"
+#include "iomanip"
+#include "fstream"
+#include "functional"
+#include <stdio.h>
+#include <unistd.h>
+
+using namespace std;
+
+struct Mode {
+    string name;
+    function<void(ProgramArguments&)> set;
+    // bytes per state projected for the default 200x200 grid with libstdc++
+    double baseline;
+};
+
+// A side x side grid: every 50th state is terminal, every 5th diagonal is a
+// chance node over its neighbors, the rest are decision nodes. Names fit the
+// short-string buffer, as those of most models do.
+void writeGrid(const string &path, int side) {
+    ofstream file(path);
+    const char *weights[] = {"", "1", "0.5 0.5", "0.25 0.25 0.5", "0.25 0.25 0.25 0.25"};
+    for (int i=0; i<side; i++) {
+        for (int j=0; j<side; j++) {
+            string name = "s" + to_string(i) + "_" + to_string(j);
+            if ((i*side + j) % 50 == 0) {
+                file<<name<<"="<<((i + j) % 2 ? 10 : -10)<<endl;
+                continue;
+            }
+            vector<string> neighbors;
+            int di[] = {1, -1, 0, 0}, dj[] = {0, 0, 1, -1};
+            for (int d=0; d<4; d++) {
+                if (i+di[d] >= 0 && i+di[d] < side && j+dj[d] >= 0 && j+dj[d] < side) {
+                    neighbors.push_back("s" + to_string(i+di[d]) + "_" + to_string(j+dj[d]));
+                }
+            }
+            file<<name<<" : [";
+            for (int k=0; k<neighbors.size(); k++) {
+                file<<(k ? ", " : "")<<neighbors[k];
+            }
+            file<<"]"<<endl;
+            file<<name<<"=-0.04"<<endl;
+            file<<name<<" % "<<((i + j) % 5 == 0 ? weights[neighbors.size()] : ".8")<<endl;
+        }
+    }
+}
+
+// four reward scenarios for the terminal states of the grid
+void writeScenarios(const string &path, int side) {
+    ofstream file(path);
+    for (int s=0; s<side*side; s+=50) {
+        file<<"s"<<s/side<<"_"<<s%side<<" = 10 -10 5 -5"<<endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int side = argc > 1 ? atoi(argv[1]) : 200;
+    string modelFile = "/tmp/MemoryBenchmark." + to_string(getpid()) + ".txt";
+    string scenarioFile = "/tmp/MemoryBenchmark." + to_string(getpid()) + ".rew";
+    writeGrid(modelFile, side);
+    writeScenarios(scenarioFile, side);
+
+    vector<Mode> modes = {
+        {"plain", [](ProgramArguments&) {}, 119.9},
+        {"-threads 4", [](ProgramArguments &a) { a.threads = 4; }, 127.9},
+        {"-worklist", [](ProgramArguments &a) { a.worklist = true; }, 147.6},
+        {"-multigrid", [](ProgramArguments &a) { a.multigrid = true; }, 434.2},
+        {"-eliminate", [](ProgramArguments &a) { a.actionElimination = true; }, 155.5},
+        {"-df 0.9,0.95,0.99", [](ProgramArguments &a) { a.discountFactors = {0.9, 0.95, 0.99}; }, 275.9},
+        {"-rewards (4 scenarios)", [scenarioFile](ProgramArguments &a) { a.rewardScenarioFile = scenarioFile; }, 367.9},
+        {"-simulate 10000", [](ProgramArguments &a) { a.simulatedTrajectories = 10000; }, 437.2},
+    };
+
+    bool regressed = false;
+    cout<<"mode                      bytes/state   baseline"<<endl;
+    for (const Mode& mode: modes) {
+        ProgramArguments arguments;
+        arguments.inputFile = modelFile;
+        arguments.discountFactor = 0.9;
+        mode.set(arguments);
+        MarkovProcessSolver solver(&arguments);
+        if (!solver.hasValidInput()) {
+            cout<<mode.name<<": cannot load the generated model"<<endl;
+            regressed = true;
+            continue;
+        }
+        double perState = (double) solver.projectedBytes()/solver.numStates();
+        bool grew = side == 200 && perState > 1.1*mode.baseline;
+        regressed = regressed || grew;
+        cout<<left<<setw(24)<<mode.name<<right<<fixed<<setprecision(1)<<setw(13)<<perState
+            <<setw(11)<<mode.baseline<<(grew ? "  REGRESSION" : "")<<endl;
+    }
+
+    remove(modelFile.c_str());
+    remove(scenarioFile.c_str());
+    return regressed ? 1 : 0;
+}
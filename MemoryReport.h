@@ -0,0 +1,135 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_MEMORYREPORT_H
+#define MARKOVPROCESSSOLVER_MEMORYREPORT_H
+
+#include "vector"
+#include "string"
+#include "unordered_map"
+#include "iostream"
+#include "iomanip"
+#include <sys/resource.h>
+
+using namespace std;
+
+// Bytes held by each of the solver's data structures, counted from what the
+// containers have allocated (capacity rather than size), and printed per
+// structure and per state or edge. Hash maps are estimated from their
+// bucket and node layout, which is close for libstdc++ but not exact.
+class MemoryReport {
+
+public:
+    // HELD structures exist now, DURING_SOLVE ones will be allocated by the
+    // solve, and WHILE_LOADING ones were already freed again (not in the total)
+    enum Lifetime { HELD, DURING_SOLVE, WHILE_LOADING };
+
+private:
+    struct Entry {
+        string structure;
+        long long bytes;
+        bool perEdge;
+        Lifetime lifetime;
+    };
+
+    long long states, edges;
+    vector<Entry> entries;
+
+    // heap bytes of a string beyond the short-string buffer inside it
+    static long long heapBytes(const string &s) {
+        return s.capacity() > 15 ? s.capacity() + 1 : 0;
+    }
+
+    static long long heapBytes(double) {
+        return 0;
+    }
+
+    template <class T>
+    static long long heapBytes(const vector<T> &v) {
+        long long bytes = v.capacity()*sizeof(T);
+        for (const T& item: v) {
+            bytes += heapBytes(item);
+        }
+        return bytes;
+    }
+
+public:
+    MemoryReport(long long states, long long edges) {
+        this->states = states;
+        this->edges = edges;
+    }
+
+    static long long bytesOf(const vector<double> &v) {
+        return sizeof(v) + v.capacity()*sizeof(double);
+    }
+
+    static long long bytesOf(const vector<int> &v) {
+        return sizeof(v) + v.capacity()*sizeof(int);
+    }
+
+    static long long bytesOf(const vector<unsigned char> &v) {
+        return sizeof(v) + v.capacity();
+    }
+
+    static long long bytesOf(const vector<string> &v) {
+        return sizeof(v) + heapBytes(v);
+    }
+
+    template <class V>
+    static long long bytesOf(const unordered_map<string, V> &map) {
+        // a node holds the next pointer, the key/value pair and the cached hash
+        long long bytes = sizeof(map) + map.bucket_count()*sizeof(void*) +
+                          map.size()*(sizeof(void*) + sizeof(pair<const string, V>) + sizeof(size_t));
+        for (auto itr = map.begin(); itr!=map.end(); itr++) {
+            bytes += heapBytes(itr->first) + heapBytes(itr->second);
+        }
+        return bytes;
+    }
+
+    // peak resident set size of this process so far
+    static long long peakResidentBytes() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return (long long) usage.ru_maxrss*1024;
+    }
+
+    // perEdge structures grow with the edges rather than the states
+    void add(const string &structure, long long bytes, bool perEdge = false, Lifetime lifetime = HELD) {
+        Entry entry;
+        entry.structure = structure;
+        entry.bytes = bytes;
+        entry.perEdge = perEdge;
+        entry.lifetime = lifetime;
+        entries.push_back(entry);
+    }
+
+    // what the solve will hold at once: everything but the loading structures
+    long long total() {
+        long long bytes = 0;
+        for (const Entry& entry: entries) {
+            if (entry.lifetime != WHILE_LOADING) {
+                bytes += entry.bytes;
+            }
+        }
+        return bytes;
+    }
+
+    void print() {
+        cout<<"Memory for "<<states<<" states and "<<edges<<" edges:"<<endl;
+        cout<<fixed<<setprecision(1);
+        const char *notes[] = {"", " (during solve)", " (while loading)"};
+        for (const Entry& entry: entries) {
+            long long per = entry.perEdge ? edges : states;
+            cout<<"  "<<left<<setw(34)<<entry.structure+notes[entry.lifetime]<<right
+                <<setw(14)<<entry.bytes<<" bytes "<<setw(8)<<(per > 0 ? (double) entry.bytes/per : 0.0)
+                <<(entry.perEdge ? " per edge" : " per state")<<endl;
+        }
+        cout<<"  "<<left<<setw(34)<<"total"<<right<<setw(14)<<total()<<" bytes "<<setw(8)
+            <<(states > 0 ? (double) total()/states : 0.0)<<" per state"<<endl;
+        cout.unsetf(ios::floatfield);
+        cout<<setprecision(6);
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_MEMORYREPORT_H
@@ -0,0 +1,213 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_MODELCACHE_H
+#define MARKOVPROCESSSOLVER_MODELCACHE_H
+
+#include "CompiledModel.h"
+#include "fstream"
+#include "iostream"
+#include "thread"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+// A directory of compiled models named after a hash of their input file's
+// contents. Entries are written to a private temporary file and renamed into
+// place, so parallel runs only ever see complete entries, and a run that
+// still has an evicted entry mapped keeps reading it. Every hit refreshes the
+// entry's modification time, which orders eviction once the directory grows
+// past its size limit. Models are cached as compiled, in name order.
+class ModelCache {
+
+private:
+    // bump whenever the layout below or the meaning of a compiled model changes
+    static const int FORMAT = 1;
+
+    // a temporary entry this old was left by a writer that died before renaming it
+    static const int STALE_TEMPORARY_SECONDS = 600;
+
+    struct Header {
+        char magic[4];
+        int format, numStates;
+        long long numEdges, nameBytes;
+    };
+
+    string directory;
+    long long sizeLimit;
+
+    string entryPath(const string &key) {
+        return directory + "/" + key + ".mpsm";
+    }
+
+    static bool endsWith(const string &name, const string &suffix) {
+        return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // Drop the least recently used entries until the directory fits its
+    // limit. Temporary files of writers still at work count against the
+    // limit; those of writers that died are removed.
+    void evict() {
+        vector<pair<time_t, pair<long long, string>>> entries;
+        long long total = 0;
+        DIR *dir = opendir(directory.c_str());
+        if (dir == nullptr) {
+            return;
+        }
+        time_t now = time(nullptr);
+        for (dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+            string name = entry->d_name;
+            struct stat info;
+            bool temporary = endsWith(name, ".tmp") && name.find(".mpsm.") != string::npos;
+            if ((!temporary && !endsWith(name, ".mpsm")) || stat((directory + "/" + name).c_str(), &info) != 0) {
+                continue;
+            }
+            if (temporary) {
+                if (now - info.st_mtime > STALE_TEMPORARY_SECONDS) {
+                    unlink((directory + "/" + name).c_str());
+                } else {
+                    total += info.st_size;
+                }
+                continue;
+            }
+            entries.push_back(make_pair(info.st_mtime, make_pair((long long) info.st_size, name)));
+            total += info.st_size;
+        }
+        closedir(dir);
+
+        sort(entries.begin(), entries.end());
+        for (int i=0; i<entries.size() && total > sizeLimit; i++) {
+            // another run may have removed it already, which is just as good
+            unlink((directory + "/" + entries[i].second.second).c_str());
+            total -= entries[i].second.first;
+        }
+    }
+
+public:
+    ModelCache(string directory, long long sizeLimit) {
+        this->directory = directory;
+        this->sizeLimit = sizeLimit;
+    }
+
+    // FNV-1a over the input file's bytes plus its size, empty if it cannot be read
+    string key(const string &inputFile) {
+        ifstream file(inputFile, ios::binary);
+        if (!file) {
+            return "";
+        }
+
+        unsigned long long hash = 14695981039346656037ULL, size = 0;
+        char buffer[1 << 16];
+        while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+            for (streamsize i=0; i<file.gcount(); i++) {
+                hash = (hash ^ (unsigned char) buffer[i])*1099511628211ULL;
+            }
+            size += file.gcount();
+        }
+
+        char hex[40];
+        snprintf(hex, sizeof(hex), "%016llx-%llx", hash, size);
+        return string(hex);
+    }
+
+    bool load(const string &key, CompiledModel &model) {
+        string path = entryPath(key);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+        void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        const char *at = (const char*) mapping;
+        Header header;
+        memcpy(&header, at, sizeof(Header));
+        long long n = header.numStates, e = header.numEdges;
+        long long expected = sizeof(Header) + n*(2*sizeof(double) + 2*sizeof(int) + 1) + 2*sizeof(int) +
+                             e*(sizeof(int) + sizeof(double)) + header.nameBytes;
+        bool ok = memcmp(header.magic, "MPSM", 4) == 0 && header.format == FORMAT && expected == info.st_size;
+        if (ok) {
+            at += sizeof(Header);
+            model.reward.assign((const double*) at, (const double*) at + n);
+            at += n*sizeof(double);
+            model.decisionProb.assign((const double*) at, (const double*) at + n);
+            at += n*sizeof(double);
+            model.weight.assign((const double*) at, (const double*) at + e);
+            at += e*sizeof(double);
+            model.offset.assign((const int*) at, (const int*) at + n + 1);
+            at += (n + 1)*sizeof(int);
+            model.target.assign((const int*) at, (const int*) at + e);
+            at += e*sizeof(int);
+            const int *nameOffset = (const int*) at;
+            at += (n + 1)*sizeof(int);
+            model.kind.assign((const unsigned char*) at, (const unsigned char*) at + n);
+            at += n;
+            model.names.resize(n);
+            model.byName.resize(n);
+            for (int i=0; i<n; i++) {
+                model.names[i].assign(at + nameOffset[i], nameOffset[i+1] - nameOffset[i]);
+                model.byName[i] = i;
+            }
+            utime(path.c_str(), nullptr);
+        }
+        munmap(mapping, info.st_size);
+        return ok;
+    }
+
+    void store(const string &key, const CompiledModel &model) {
+        mkdir(directory.c_str(), 0755);
+
+        vector<int> nameOffset(1, 0);
+        for (const string& name: model.names) {
+            nameOffset.push_back(nameOffset.back() + name.size());
+        }
+        Header header;
+        memcpy(header.magic, "MPSM", 4);
+        header.format = FORMAT;
+        header.numStates = model.numStates();
+        header.numEdges = model.target.size();
+        header.nameBytes = nameOffset.back();
+
+        string temporary = entryPath(key) + "." + to_string(getpid()) + "." +
+                           to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+        ofstream out(temporary, ios::binary | ios::trunc);
+        out.write((const char*) &header, sizeof(Header));
+        out.write((const char*) model.reward.data(), model.reward.size()*sizeof(double));
+        out.write((const char*) model.decisionProb.data(), model.decisionProb.size()*sizeof(double));
+        out.write((const char*) model.weight.data(), model.weight.size()*sizeof(double));
+        out.write((const char*) model.offset.data(), model.offset.size()*sizeof(int));
+        out.write((const char*) model.target.data(), model.target.size()*sizeof(int));
+        out.write((const char*) nameOffset.data(), nameOffset.size()*sizeof(int));
+        out.write((const char*) model.kind.data(), model.kind.size());
+        for (const string& name: model.names) {
+            out.write(name.data(), name.size());
+        }
+        out.close();
+
+        if (out.fail() || rename(temporary.c_str(), entryPath(key).c_str()) != 0) {
+            unlink(temporary.c_str());
+            cout<<"Could not write compiled model to cache directory: "<<directory<<endl;
+            return;
+        }
+        evict();
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_MODELCACHE_H
@@ -0,0 +1,330 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_MULTILANESOLVER_H
+#define MARKOVPROCESSSOLVER_MULTILANESOLVER_H
+
+#include "CompiledModel.h"
+#include "PolicyKernels.h"
+#include "vector"
+#include "algorithm"
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// The lane kernels compute one state's new value in every lane. They run
+// over blocks of lanes with the edges inside, so each block accumulates in a
+// register; value holds the lanes of state s at value[s*lanes].
+
+// result[k] = reward[k] + the sum of discount[k]*weight*value over the edges
+inline void chanceLanes(double *result, const double *reward, const double *value, const int *target,
+                        const double *weight, int begin, int end, const double *discount, int lanes) {
+    int k = 0;
+#if defined(__AVX__)
+    for (; k+4<=lanes; k+=4) {
+        __m256d acc = _mm256_loadu_pd(reward + k), d4 = _mm256_loadu_pd(discount + k);
+        for (int e=begin; e<end; e++) {
+            __m256d v = _mm256_loadu_pd(value + (size_t) target[e]*lanes + k);
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_mul_pd(d4, _mm256_set1_pd(weight[e])), v));
+        }
+        _mm256_storeu_pd(result + k, acc);
+    }
+#endif
+#ifdef __SSE2__
+    for (; k+2<=lanes; k+=2) {
+        __m128d acc = _mm_loadu_pd(reward + k), d2 = _mm_loadu_pd(discount + k);
+        for (int e=begin; e<end; e++) {
+            __m128d v = _mm_loadu_pd(value + (size_t) target[e]*lanes + k);
+            acc = _mm_add_pd(acc, _mm_mul_pd(_mm_mul_pd(d2, _mm_set1_pd(weight[e])), v));
+        }
+        _mm_storeu_pd(result + k, acc);
+    }
+#endif
+    for (; k<lanes; k++) {
+        double acc = reward[k];
+        for (int e=begin; e<end; e++) {
+            acc += discount[k]*weight[e]*value[(size_t) target[e]*lanes + k];
+        }
+        result[k] = acc;
+    }
+}
+
+// result[k] = reward[k] + chosenShare[k]*value of the lane's chosen neighbor
+// + (otherShare[k]*value)/others of every other neighbor; chosen holds the
+// lanes' choices as doubles
+inline void decisionLanes(double *result, const double *reward, const double *value, const int *target,
+                          int begin, int end, const double *chosen, const double *chosenShare,
+                          const double *otherShare, double others, int lanes) {
+    int k = 0;
+#if defined(__AVX__)
+    __m256d d4 = _mm256_set1_pd(others);
+    for (; k+4<=lanes; k+=4) {
+        __m256d acc = _mm256_loadu_pd(reward + k), choice = _mm256_loadu_pd(chosen + k);
+        __m256d chosen4 = _mm256_loadu_pd(chosenShare + k), other4 = _mm256_loadu_pd(otherShare + k);
+        for (int e=begin; e<end; e++) {
+            __m256d v = _mm256_loadu_pd(value + (size_t) target[e]*lanes + k);
+            __m256d isChosen = _mm256_cmp_pd(choice, _mm256_set1_pd(target[e]), _CMP_EQ_OQ);
+            __m256d otherTerm = _mm256_div_pd(_mm256_mul_pd(other4, v), d4);
+            acc = _mm256_add_pd(acc, _mm256_blendv_pd(otherTerm, _mm256_mul_pd(chosen4, v), isChosen));
+        }
+        _mm256_storeu_pd(result + k, acc);
+    }
+#endif
+#ifdef __SSE2__
+    __m128d d2 = _mm_set1_pd(others);
+    for (; k+2<=lanes; k+=2) {
+        __m128d acc = _mm_loadu_pd(reward + k), choice = _mm_loadu_pd(chosen + k);
+        __m128d chosen2 = _mm_loadu_pd(chosenShare + k), other2 = _mm_loadu_pd(otherShare + k);
+        for (int e=begin; e<end; e++) {
+            __m128d v = _mm_loadu_pd(value + (size_t) target[e]*lanes + k);
+            __m128d isChosen = _mm_cmpeq_pd(choice, _mm_set1_pd(target[e]));
+            __m128d otherTerm = _mm_div_pd(_mm_mul_pd(other2, v), d2);
+            __m128d term = _mm_or_pd(_mm_and_pd(isChosen, _mm_mul_pd(chosen2, v)), _mm_andnot_pd(isChosen, otherTerm));
+            acc = _mm_add_pd(acc, term);
+        }
+        _mm_storeu_pd(result + k, acc);
+    }
+#endif
+    for (; k<lanes; k++) {
+        double acc = reward[k];
+        for (int e=begin; e<end; e++) {
+            double v = value[(size_t) target[e]*lanes + k];
+            double chosenTerm = chosenShare[k]*v;
+            double otherTerm = (otherShare[k]*v)/others;
+            acc += chosen[k] == target[e] ? chosenTerm : otherTerm;
+        }
+        result[k] = acc;
+    }
+}
+
+// Policy iteration for K variants of one model at once, each lane with its own
+// rewards and discount factor over the shared transitions. Values and rewards
+// are stored as a dense block with the lanes of a state next to each other
+// (value[state*lanes + lane]), so a sweep reads every edge once and applies
+// it to all lanes. Each lane keeps its own policy and rounds: once it has
+// converged or used up the iterations its policy is improved on the spot and
+// its next round starts with the next sweep. A lane whose policy holds is
+// copied out and the block is repacked without it. Each lane does exactly the
+// arithmetic of a Gauss-Seidel solve of its variant alone, so the results are
+// the same.
+class MultiLaneSolver {
+
+private:
+    const CompiledModel &model;
+    int variants, lanes;
+    double tolerance;
+    int iterations;
+    bool maximise;
+    // the live block: variant[lane] is the variant a lane holds
+    vector<double> reward, value, discount;
+    vector<int> policy, variant;
+    // results by variant, filled in as variants finish
+    vector<double> finalValue;
+    vector<int> finalPolicy, rounds;
+
+    template <class Direction>
+    int greedyLane(int node, int lane, const vector<double> &score) {
+        int greedy = -1;
+        double greedyScore = Direction::worst();
+        for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+            double candidate = score[(size_t) model.target[e]*lanes + lane];
+            if (Direction::better(candidate, greedyScore)) {
+                greedyScore = candidate;
+                greedy = model.target[e];
+            }
+        }
+        return greedy;
+    }
+
+    // improves one lane's policy, returns whether it changed
+    template <class Direction>
+    bool improve(int lane) {
+        bool changed = false;
+        for (int node=0; node<model.numStates(); node++) {
+            if (model.kind[node] == CompiledModel::DECISION) {
+                int greedy = greedyLane<Direction>(node, lane, value);
+                changed = changed || greedy != policy[(size_t) node*lanes + lane];
+                policy[(size_t) node*lanes + lane] = greedy;
+            }
+        }
+        return changed;
+    }
+
+    // one Gauss-Seidel sweep of every lane, counting per lane the states that
+    // moved at most the tolerance
+    void sweep(vector<int> &counts) {
+        int n = model.numStates();
+        vector<double> acc(lanes), chosen(lanes), chosenShare(lanes), otherShare(lanes);
+        fill(counts.begin(), counts.end(), 0);
+        for (int node=0; node<n; node++) {
+            if (model.kind[node] == CompiledModel::TERMINAL) {
+                continue;
+            }
+            double *current = &value[(size_t) node*lanes];
+            const double *nodeReward = &reward[(size_t) node*lanes];
+            int begin = model.offset[node], end = model.offset[node+1];
+
+            if (model.kind[node] == CompiledModel::DECISION) {
+                int degree = end - begin;
+                double p = model.decisionProb[node];
+                int others = max(1, degree - 1);
+                for (int lane=0; lane<lanes; lane++) {
+                    chosen[lane] = policy[(size_t) node*lanes + lane];
+                    chosenShare[lane] = discount[lane]*p;
+                    otherShare[lane] = degree > 1 ? discount[lane]*(1.0 - p) : 0.0;
+                }
+                decisionLanes(acc.data(), nodeReward, value.data(), model.target.data(), begin, end,
+                              chosen.data(), chosenShare.data(), otherShare.data(), others, lanes);
+            } else {
+                chanceLanes(acc.data(), nodeReward, value.data(), model.target.data(), model.weight.data(),
+                            begin, end, discount.data(), lanes);
+            }
+
+            for (int lane=0; lane<lanes; lane++) {
+                if (abs(acc[lane] - current[lane]) <= tolerance) {
+                    counts[lane]++;
+                }
+                current[lane] = acc[lane];
+            }
+        }
+    }
+
+    // copies the finished lanes' results out and rebuilds the block from the others
+    void retire(const vector<char> &finished) {
+        int n = model.numStates();
+        vector<int> kept;
+        for (int lane=0; lane<lanes; lane++) {
+            if (!finished[lane]) {
+                kept.push_back(lane);
+                continue;
+            }
+            for (int node=0; node<n; node++) {
+                finalValue[(size_t) node*variants + variant[lane]] = value[(size_t) node*lanes + lane];
+                finalPolicy[(size_t) node*variants + variant[lane]] = policy[(size_t) node*lanes + lane];
+            }
+        }
+
+        int keptLanes = kept.size();
+        vector<double> keptReward((size_t) n*keptLanes), keptValue((size_t) n*keptLanes);
+        vector<int> keptPolicy((size_t) n*keptLanes), keptVariant(keptLanes);
+        vector<double> keptDiscount(keptLanes);
+        for (int i=0; i<keptLanes; i++) {
+            keptVariant[i] = variant[kept[i]];
+            keptDiscount[i] = discount[kept[i]];
+            for (int node=0; node<n; node++) {
+                keptReward[(size_t) node*keptLanes + i] = reward[(size_t) node*lanes + kept[i]];
+                keptValue[(size_t) node*keptLanes + i] = value[(size_t) node*lanes + kept[i]];
+                keptPolicy[(size_t) node*keptLanes + i] = policy[(size_t) node*lanes + kept[i]];
+            }
+        }
+        reward.swap(keptReward);
+        value.swap(keptValue);
+        policy.swap(keptPolicy);
+        variant.swap(keptVariant);
+        discount.swap(keptDiscount);
+        lanes = keptLanes;
+    }
+
+    template <class Direction>
+    void initialPolicies() {
+        for (int node=0; node<model.numStates(); node++) {
+            if (model.kind[node] == CompiledModel::DECISION) {
+                for (int lane=0; lane<lanes; lane++) {
+                    policy[(size_t) node*lanes + lane] = greedyLane<Direction>(node, lane, reward);
+                }
+            }
+        }
+    }
+
+public:
+    // rewards holds the variants of every state next to each other, as value
+    // does, and discountFactors the discount factor of every variant
+    MultiLaneSolver(const CompiledModel &model, const vector<double> &rewards, const vector<double> &discountFactors,
+                    double tolerance, int iterations, bool maximise) : model(model) {
+        this->variants = discountFactors.size();
+        this->lanes = variants;
+        this->discount = discountFactors;
+        this->tolerance = tolerance;
+        this->iterations = iterations;
+        this->maximise = maximise;
+        this->reward = rewards;
+        int n = model.numStates();
+
+        value.assign((size_t) n*lanes, 0.0);
+        for (int node=0; node<n; node++) {
+            if (model.kind[node] == CompiledModel::TERMINAL) {
+                copy(reward.begin() + (size_t) node*lanes, reward.begin() + (size_t) (node+1)*lanes, value.begin() + (size_t) node*lanes);
+            }
+        }
+        policy.assign((size_t) n*lanes, -1);
+        variant.resize(lanes);
+        for (int lane=0; lane<lanes; lane++) {
+            variant[lane] = lane;
+        }
+        if (maximise) {
+            initialPolicies<Maximise>();
+        } else {
+            initialPolicies<Minimise>();
+        }
+        finalValue.assign((size_t) n*variants, 0.0);
+        finalPolicy.assign((size_t) n*variants, -1);
+        rounds.assign(variants, 0);
+    }
+
+    void solve() {
+        vector<int> counts(lanes), sweeps(lanes, 0);
+        while (lanes > 0) {
+            if (iterations > 0) {
+                sweep(counts);
+            }
+
+            vector<char> finished(lanes, false);
+            bool anyFinished = false;
+            for (int lane=0; lane<lanes; lane++) {
+                if (iterations > 0 && counts[lane] != model.numStates() && ++sweeps[lane] < iterations) {
+                    continue;
+                }
+                // this lane's round is over
+                bool changed = maximise ? improve<Maximise>(lane) : improve<Minimise>(lane);
+                rounds[variant[lane]]++;
+                sweeps[lane] = 0;
+                finished[lane] = !changed;
+                anyFinished = anyFinished || !changed;
+            }
+
+            if (anyFinished) {
+                vector<int> keptSweeps;
+                for (int lane=0; lane<lanes; lane++) {
+                    if (!finished[lane]) {
+                        keptSweeps.push_back(sweeps[lane]);
+                    }
+                }
+                retire(finished);
+                sweeps.swap(keptSweeps);
+                counts.resize(lanes);
+            }
+        }
+    }
+
+    double valueOf(int node, int k) const {
+        return finalValue[(size_t) node*variants + k];
+    }
+
+    int policyOf(int node, int k) const {
+        return finalPolicy[(size_t) node*variants + k];
+    }
+
+    // policy iteration rounds variant k took
+    int roundsOf(int k) const {
+        return rounds[k];
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_MULTILANESOLVER_H
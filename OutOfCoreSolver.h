@@ -0,0 +1,556 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_OUTOFCORESOLVER_H
+#define MARKOVPROCESSSOLVER_OUTOFCORESOLVER_H
+
+#include "MarkovProcessSolver.h"
+#include "CompiledModel.h"
+#include "PolicyKernels.h"
+#include "set"
+#include "deque"
+#include "thread"
+#include "mutex"
+#include "condition_variable"
+#include <math.h>
+
+using namespace std;
+
+// Solves models whose transitions do not fit in memory. The input file is
+// compiled into a block-ordered file on disk (states numbered in name order,
+// one block per range of states) and every evaluation sweep and improvement
+// pass streams that file sequentially while a reader thread prefetches the
+// next blocks. Only per-state vectors (names, rewards, values, policies) stay
+// resident.
+class OutOfCoreSolver {
+
+private:
+    struct Block {
+        int firstState, stateCount;
+        long long edgeCount;
+        vector<int> degree;
+        vector<unsigned char> kind;
+        vector<double> p;
+        vector<int> target;
+        vector<double> weight;
+    };
+
+    // reads the blocks of a compiled file front to back on its own thread,
+    // keeping up to two blocks ready ahead of the consumer. A block that cannot
+    // be read ends the stream early; failedBlock() then tells the consumer which.
+    class BlockStream {
+    private:
+        ifstream file;
+        int numBlocks, failed;
+        Block pool[3];
+        deque<Block*> freeBlocks, readyBlocks;
+        Block *current;
+        bool finished, stopped;
+        mutex lock;
+        condition_variable changed;
+        thread reader;
+
+        bool readBlock(Block *block) {
+            file.read((char*) &block->firstState, sizeof(int));
+            file.read((char*) &block->stateCount, sizeof(int));
+            file.read((char*) &block->edgeCount, sizeof(long long));
+            block->degree.resize(block->stateCount);
+            block->kind.resize(block->stateCount);
+            block->p.resize(block->stateCount);
+            block->target.resize(block->edgeCount);
+            block->weight.resize(block->edgeCount);
+            file.read((char*) block->degree.data(), block->stateCount*sizeof(int));
+            file.read((char*) block->kind.data(), block->stateCount*sizeof(unsigned char));
+            file.read((char*) block->p.data(), block->stateCount*sizeof(double));
+            file.read((char*) block->target.data(), block->edgeCount*sizeof(int));
+            file.read((char*) block->weight.data(), block->edgeCount*sizeof(double));
+            return (bool) file;
+        }
+
+        void readAll() {
+            for (int i=0; i<numBlocks; i++) {
+                Block *block;
+                {
+                    unique_lock<mutex> guard(lock);
+                    changed.wait(guard, [this] { return stopped || !freeBlocks.empty(); });
+                    if (stopped) {
+                        break;
+                    }
+                    block = freeBlocks.front();
+                    freeBlocks.pop_front();
+                }
+                bool ok = readBlock(block);
+                unique_lock<mutex> guard(lock);
+                if (!ok) {
+                    failed = i;
+                    break;
+                }
+                readyBlocks.push_back(block);
+                changed.notify_all();
+            }
+            unique_lock<mutex> guard(lock);
+            finished = true;
+            changed.notify_all();
+        }
+
+    public:
+        BlockStream(const string &path, streamoff dataStart, int numBlocks) : file(path, ios::binary) {
+            this->numBlocks = numBlocks;
+            this->failed = -1;
+            this->current = nullptr;
+            this->finished = false;
+            this->stopped = false;
+            file.seekg(dataStart);
+            for (int i=0; i<3; i++) {
+                freeBlocks.push_back(&pool[i]);
+            }
+            reader = thread(&BlockStream::readAll, this);
+        }
+
+        // hands out the next block in state order, recycling the previous one
+        bool next(Block *&block) {
+            unique_lock<mutex> guard(lock);
+            if (current != nullptr) {
+                freeBlocks.push_back(current);
+                current = nullptr;
+                changed.notify_all();
+            }
+            changed.wait(guard, [this] { return finished || !readyBlocks.empty(); });
+            if (readyBlocks.empty()) {
+                return false;
+            }
+            current = readyBlocks.front();
+            readyBlocks.pop_front();
+            block = current;
+            return true;
+        }
+
+        // the block that could not be read once next() has returned false, or -1
+        int failedBlock() {
+            unique_lock<mutex> guard(lock);
+            return failed;
+        }
+
+        ~BlockStream() {
+            {
+                unique_lock<mutex> guard(lock);
+                stopped = true;
+                changed.notify_all();
+            }
+            reader.join();
+        }
+    };
+
+    vector<string> names;
+    vector<double> reward;
+    vector<double> value;
+    vector<int> policy;
+    vector<bool> printPolicy;
+    string blockFile;
+    streamoff dataStart;
+    int numStates, numBlocks, blockStates;
+    double discountFactor;
+    int iterations;
+    double tolerance;
+    bool maximise, correctInputFormat, readFailed;
+
+    // first pass: validate the file and collect node names and rewards
+    void collectStates(string inputFile) {
+        correctInputFormat = true;
+        ifstream file(inputFile);
+        string line;
+        set<string> nodes;
+        unordered_map<string, double> rewards;
+
+        while (getline(file, line)) {
+            MarkovProcessSolver::removeLeadingAndTrailingWhitespace(line);
+
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            if (line.find('=') != string::npos) {
+                vector<string> nodeReward = MarkovProcessSolver::split(line, '=');
+                rewards[nodeReward[0]] = stod(nodeReward[1]);
+                nodes.insert(nodeReward[0]);
+            } else if (line.find('%') != string::npos) {
+                vector<string> nodeProbability = MarkovProcessSolver::split(line, '%');
+                vector<string> p = MarkovProcessSolver::split(nodeProbability[1], ' ');
+
+                double ps = 0.0;
+                for (const string& pr: p) {
+                    ps += stod(pr);
+                }
+
+                if (p.size()>1 and ps!=1.0) {
+                    correctInputFormat = false;
+                    cout<<"Error in line: "<<line<<endl;
+                    break;
+                }
+            } else if (line.find(':') != string::npos) {
+                vector<string> nodeEdges = MarkovProcessSolver::split(line, ':');
+
+                if (nodeEdges[1][0]!='[' || nodeEdges[1][nodeEdges[1].size()-1]!=']') {
+                    correctInputFormat = false;
+                    cout<<"Error in line: "<<line<<endl;
+                    break;
+                }
+
+                nodeEdges[1] = nodeEdges[1].substr(1, nodeEdges[1].size()-2);
+                vector<string> neighbors = MarkovProcessSolver::split(nodeEdges[1], ',');
+
+                nodes.insert(nodeEdges[0]);
+                for (const string& ne: neighbors) {
+                    nodes.insert(ne);
+                }
+            }
+        }
+
+        names.assign(nodes.begin(), nodes.end());
+        numStates = names.size();
+        reward.assign(numStates, 0.0);
+        for (int i=0; i<numStates; i++) {
+            auto itr = rewards.find(names[i]);
+            if (itr != rewards.end()) {
+                reward[i] = itr->second;
+            }
+        }
+    }
+
+    // bytes of bucket records held in memory before they are appended to the bucket files
+    static const size_t BUCKET_BUFFER_BYTES = 64 << 20;
+
+    string bucketFile(int bucket) {
+        return blockFile + ".bucket" + to_string(bucket);
+    }
+
+    // appends every buffered record to its bucket file, opening one file at a
+    // time so that the number of blocks is not limited by open file handles
+    bool flushBuckets(vector<string> &buffers, size_t &buffered) {
+        bool ok = true;
+        for (int b=0; b<numBlocks; b++) {
+            if (buffers[b].empty()) {
+                continue;
+            }
+            ofstream out(bucketFile(b), ios::binary | ios::app);
+            out.write(buffers[b].data(), buffers[b].size());
+            out.close();
+            ok = ok && !out.fail();
+            string().swap(buffers[b]);
+        }
+        buffered = 0;
+        return ok;
+    }
+
+    // second pass: scatter edge and probability lines into one bucket file per
+    // block, so that no more than a block of transitions is ever held in memory
+    bool distributeTransitions(string inputFile) {
+        unordered_map<string, int> id;
+        for (int i=0; i<numStates; i++) {
+            id[names[i]] = i;
+        }
+
+        bool ok = true;
+        for (int b=0; b<numBlocks && ok; b++) {
+            ofstream bucket(bucketFile(b), ios::binary | ios::trunc);
+            ok = (bool) bucket;
+        }
+        vector<string> buffers(numBlocks);
+        size_t buffered = 0;
+
+        ifstream file(inputFile);
+        string line;
+        while (ok && getline(file, line)) {
+            MarkovProcessSolver::removeLeadingAndTrailingWhitespace(line);
+
+            if (line.empty() || line[0] == '#' || line.find('=') != string::npos) {
+                continue;
+            }
+
+            char tag;
+            string node;
+            vector<int> targets;
+            vector<double> probabilities;
+            if (line.find('%') != string::npos) {
+                vector<string> nodeProbability = MarkovProcessSolver::split(line, '%');
+                for (const string& pr: MarkovProcessSolver::split(nodeProbability[1], ' ')) {
+                    probabilities.push_back(stod(pr));
+                }
+                tag = 'P';
+                node = nodeProbability[0];
+            } else if (line.find(':') != string::npos) {
+                vector<string> nodeEdges = MarkovProcessSolver::split(line, ':');
+                nodeEdges[1] = nodeEdges[1].substr(1, nodeEdges[1].size()-2);
+                for (const string& ne: MarkovProcessSolver::split(nodeEdges[1], ',')) {
+                    targets.push_back(id[ne]);
+                }
+                tag = 'E';
+                node = nodeEdges[0];
+            } else {
+                continue;
+            }
+
+            // probabilities of nodes that have no edges and no reward never matter
+            auto itr = id.find(node);
+            if (itr == id.end()) {
+                continue;
+            }
+
+            int state = itr->second;
+            int count = tag == 'E' ? targets.size() : probabilities.size();
+            string &out = buffers[state/blockStates];
+            size_t before = out.size();
+            out.append(&tag, sizeof(char));
+            out.append((char*) &state, sizeof(int));
+            out.append((char*) &count, sizeof(int));
+            if (tag == 'E') {
+                out.append((char*) targets.data(), count*sizeof(int));
+            } else {
+                out.append((char*) probabilities.data(), count*sizeof(double));
+            }
+            buffered += out.size() - before;
+            if (buffered >= BUCKET_BUFFER_BYTES) {
+                ok = flushBuckets(buffers, buffered);
+            }
+        }
+        return ok && flushBuckets(buffers, buffered);
+    }
+
+    // third pass: turn every bucket into one block of the compiled file
+    bool writeBlocks() {
+        ofstream out(blockFile, ios::binary | ios::trunc);
+        out.write((char*) &numStates, sizeof(int));
+        out.write((char*) &blockStates, sizeof(int));
+        out.write((char*) &numBlocks, sizeof(int));
+        dataStart = out.tellp();
+
+        for (int b=0; b<numBlocks; b++) {
+            Block block;
+            block.firstState = b*blockStates;
+            block.stateCount = min(blockStates, numStates - block.firstState);
+
+            vector<vector<int>> edges(block.stateCount);
+            vector<vector<double>> probabilities(block.stateCount);
+            ifstream in(bucketFile(b), ios::binary);
+            char tag;
+            while (in.read(&tag, sizeof(char))) {
+                int state, count;
+                in.read((char*) &state, sizeof(int));
+                in.read((char*) &count, sizeof(int));
+                int local = state - block.firstState;
+                if (tag == 'E') {
+                    size_t at = edges[local].size();
+                    edges[local].resize(at + count);
+                    in.read((char*) (edges[local].data() + at), count*sizeof(int));
+                } else {
+                    size_t at = probabilities[local].size();
+                    probabilities[local].resize(at + count);
+                    in.read((char*) (probabilities[local].data() + at), count*sizeof(double));
+                }
+            }
+            in.close();
+            remove(bucketFile(b).c_str());
+
+            block.edgeCount = 0;
+            for (int s=0; s<block.stateCount; s++) {
+                int degree = edges[s].size();
+                block.degree.push_back(degree);
+                if (degree == 0) {
+                    block.kind.push_back(CompiledModel::TERMINAL);
+                    block.p.push_back(0.0);
+                } else if (probabilities[s].size() > 1) {
+                    block.kind.push_back(CompiledModel::CHANCE);
+                    block.p.push_back(0.0);
+                } else {
+                    block.kind.push_back(CompiledModel::DECISION);
+                    block.p.push_back(probabilities[s].empty() ? 1.0 : probabilities[s][0]);
+                }
+                for (int e=0; e<degree; e++) {
+                    block.target.push_back(edges[s][e]);
+                    bool weighted = block.kind[s] == CompiledModel::CHANCE && e < probabilities[s].size();
+                    block.weight.push_back(weighted ? probabilities[s][e] : 0.0);
+                }
+                block.edgeCount += degree;
+            }
+
+            out.write((char*) &block.firstState, sizeof(int));
+            out.write((char*) &block.stateCount, sizeof(int));
+            out.write((char*) &block.edgeCount, sizeof(long long));
+            out.write((char*) block.degree.data(), block.stateCount*sizeof(int));
+            out.write((char*) block.kind.data(), block.stateCount*sizeof(unsigned char));
+            out.write((char*) block.p.data(), block.stateCount*sizeof(double));
+            out.write((char*) block.target.data(), block.edgeCount*sizeof(int));
+            out.write((char*) block.weight.data(), block.edgeCount*sizeof(double));
+        }
+
+        out.close();
+        return !out.fail();
+    }
+
+    void compile(string inputFile) {
+        collectStates(inputFile);
+        if (!correctInputFormat) {
+            return;
+        }
+
+        numBlocks = (numStates + blockStates - 1)/blockStates;
+        if (!distributeTransitions(inputFile) || !writeBlocks()) {
+            correctInputFormat = false;
+            cout<<"Error writing compiled transition file: "<<blockFile<<endl;
+        }
+    }
+
+    // true once a stream has delivered every block; otherwise reports the block
+    // it stopped at and marks the solve as failed
+    bool streamed(BlockStream &stream) {
+        int failed = stream.failedBlock();
+        if (failed >= 0) {
+            cout<<"Error reading block "<<failed<<" of compiled transition file: "<<blockFile<<endl;
+            readFailed = true;
+        }
+        return failed < 0;
+    }
+
+    void init() {
+        value.assign(numStates, 0.0);
+        policy.assign(numStates, -1);
+        printPolicy.assign(numStates, false);
+
+        // assign initial values and policies based on neighbor with most reward
+        BlockStream stream(blockFile, dataStart, numBlocks);
+        Block *block;
+        while (stream.next(block)) {
+            long long edge = 0;
+            for (int s=0; s<block->stateCount; s++) {
+                int node = block->firstState + s;
+                int degree = block->degree[s];
+                if (block->kind[s] == CompiledModel::TERMINAL) {
+                    value[node] = reward[node];
+                } else if (block->kind[s] == CompiledModel::DECISION) {
+                    policy[node] = greedyNeighbor(&block->target[edge], degree, reward);
+                    printPolicy[node] = degree > 1;
+                }
+                edge += degree;
+            }
+        }
+        streamed(stream);
+    }
+
+    int greedyNeighbor(const int *targets, int degree, const vector<double> &score) {
+        if (maximise) {
+            return greedyTarget<Maximise>(targets, 0, degree, score);
+        }
+        return greedyTarget<Minimise>(targets, 0, degree, score);
+    }
+
+    bool greedyPolicyComputation() {
+        bool policyChanged = false;
+        BlockStream stream(blockFile, dataStart, numBlocks);
+        Block *block;
+        while (stream.next(block)) {
+            long long edge = 0;
+            for (int s=0; s<block->stateCount; s++) {
+                int node = block->firstState + s;
+                if (block->kind[s] == CompiledModel::DECISION) {
+                    int greedy = greedyNeighbor(&block->target[edge], block->degree[s], value);
+                    policyChanged = policyChanged || greedy != policy[node];
+                    policy[node] = greedy;
+                }
+                edge += block->degree[s];
+            }
+        }
+        return streamed(stream) && policyChanged;
+    }
+
+    void valueIteration() {
+        int i = 0;
+        while (i<iterations) {
+            int count = 0;
+            BlockStream stream(blockFile, dataStart, numBlocks);
+            Block *block;
+            while (stream.next(block)) {
+                long long edge = 0;
+                for (int s=0; s<block->stateCount; s++) {
+                    int node = block->firstState + s;
+                    int degree = block->degree[s];
+                    const int *targets = &block->target[edge];
+                    const double *weights = &block->weight[edge];
+                    edge += degree;
+                    if (block->kind[s] == CompiledModel::TERMINAL) {
+                        continue;
+                    }
+
+                    double currentValue = value[node];
+                    auto read = [this](int neighbor) {
+                        return value[neighbor];
+                    };
+                    double newValue;
+                    if (block->kind[s] == CompiledModel::DECISION) {
+                        newValue = decisionBackup(reward[node], targets, 0, degree, policy[node], block->p[s], discountFactor, read);
+                    } else {
+                        newValue = chanceBackup(reward[node], targets, weights, 0, degree, discountFactor, read);
+                    }
+
+                    value[node] = newValue;
+                    if (fabs(newValue - currentValue) <= tolerance) {
+                        count++;
+                    }
+                }
+            }
+            if (!streamed(stream)) {
+                return;
+            }
+            if (count == numStates) {
+                break;
+            }
+            i++;
+        }
+    }
+
+    void printPolicyAndValues() {
+        for (int node=0; node<numStates; node++) {
+            if (printPolicy[node]) {
+                cout<<names[node]<<" -> "<<names[policy[node]]<<endl;
+            }
+        }
+
+        cout<<endl;
+
+        for (int node=0; node<numStates; node++) {
+            cout<<names[node]<<"="<<value[node]<<" ";
+        }
+    }
+
+public:
+    OutOfCoreSolver(ProgramArguments *arguments) {
+        this->tolerance = arguments->tolerance;
+        this->iterations = arguments->iterations;
+        this->maximise = arguments->maximise;
+        this->discountFactor = arguments->discountFactor;
+        this->blockFile = arguments->blockFile;
+        this->blockStates = arguments->blockStates;
+        this->readFailed = false;
+        compile(arguments->inputFile);
+        if (correctInputFormat) {
+            init();
+        }
+    }
+
+    void solve() {
+        if (correctInputFormat) {
+            bool policyChanged = !readFailed;
+            while (policyChanged) {
+                valueIteration();
+                policyChanged = !readFailed && greedyPolicyComputation();
+            }
+            if (!readFailed) {
+                printPolicyAndValues();
+            }
+        } else {
+            cout<<"Cannot run markov process solver as input file format is not correct"<<endl;
+        }
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_OUTOFCORESOLVER_H
@@ -0,0 +1,370 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_PARTITIONEDSOLVER_H
+#define MARKOVPROCESSSOLVER_PARTITIONEDSOLVER_H
+
+#include "CompiledModel.h"
+#include "PolicyKernels.h"
+#include "iostream"
+#include "chrono"
+#include <math.h>
+#include <float.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+using namespace std;
+
+// how long workers get to exit after the solve before they are killed
+const int WORKER_GRACE_SECONDS = 5;
+
+// Moves bytes between the cooperating worker processes of a partitioned solve.
+// The transport is created before the workers are forked; every worker then
+// calls bind() with its rank before talking to its peers.
+class Transport {
+public:
+    virtual ~Transport() {}
+    virtual int size() = 0;
+    virtual void bind(int rank) = 0;
+    virtual bool send(int peer, const void *data, size_t bytes) = 0;
+    virtual bool receive(int peer, void *data, size_t bytes) = 0;
+    // closes this worker's ends, so peers waiting on it see end of file
+    virtual void disconnect() = 0;
+};
+
+// A full mesh of Unix domain socket pairs between all workers of one machine.
+class SocketTransport : public Transport {
+private:
+    int processes, self;
+    vector<vector<int>> fds;
+
+public:
+    SocketTransport(int processes) {
+        this->processes = processes;
+        this->self = 0;
+        fds.assign(processes, vector<int>(processes, -1));
+        for (int i=0; i<processes; i++) {
+            for (int j=i+1; j<processes; j++) {
+                int pair[2];
+                if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+                    fds[i][j] = pair[0];
+                    fds[j][i] = pair[1];
+                }
+            }
+        }
+    }
+
+    ~SocketTransport() {
+        disconnect();
+    }
+
+    int size() {
+        return processes;
+    }
+
+    // keep only the ends that belong to this worker
+    void bind(int rank) {
+        self = rank;
+        for (int i=0; i<processes; i++) {
+            for (int j=0; j<processes; j++) {
+                if (i != rank && fds[i][j] >= 0) {
+                    close(fds[i][j]);
+                    fds[i][j] = -1;
+                }
+            }
+        }
+    }
+
+    bool send(int peer, const void *data, size_t bytes) {
+        const char *at = (const char*) data;
+        while (bytes > 0) {
+            ssize_t sent = ::send(fds[self][peer], at, bytes, MSG_NOSIGNAL);
+            if (sent <= 0) {
+                return false;
+            }
+            at += sent;
+            bytes -= sent;
+        }
+        return true;
+    }
+
+    bool receive(int peer, void *data, size_t bytes) {
+        char *at = (char*) data;
+        while (bytes > 0) {
+            ssize_t received = read(fds[self][peer], at, bytes);
+            if (received <= 0) {
+                return false;
+            }
+            at += received;
+            bytes -= received;
+        }
+        return true;
+    }
+
+    void disconnect() {
+        for (int i=0; i<processes; i++) {
+            for (int j=0; j<processes; j++) {
+                if (fds[i][j] >= 0) {
+                    close(fds[i][j]);
+                    fds[i][j] = -1;
+                }
+            }
+        }
+    }
+};
+
+// Splits the compiled state graph into contiguous blocks of states, one per
+// worker process. Each worker sweeps its own block and then exchanges the
+// values its neighbors read ("halo") with them. The convergence and
+// policy-stability checks are sums reduced through rank 0.
+class PartitionedSolver {
+
+private:
+    const CompiledModel &model;
+    Transport *transport;
+    vector<int> start;
+    vector<vector<int>> sendStates, receiveStates;
+    int rank, processes;
+    double discountFactor;
+    int iterations;
+    double tolerance;
+    bool maximise, ok;
+
+    int owner(int state) {
+        return upper_bound(start.begin(), start.end(), state) - start.begin() - 1;
+    }
+
+    // blocks of roughly equal work, counting a state and each of its edges
+    void partition() {
+        long long work = model.numStates() + model.target.size();
+        start.assign(1, 0);
+        long long done = 0;
+        for (int node=0; node<model.numStates(); node++) {
+            done += 1 + model.degree(node);
+            if (done*processes >= work*(long long) start.size() && start.size() < processes) {
+                start.push_back(node+1);
+            }
+        }
+        while (start.size() <= processes) {
+            start.push_back(model.numStates());
+        }
+    }
+
+    // the non-terminal states of peer blocks that this block reads, and the reverse
+    void findHalos() {
+        sendStates.assign(processes, vector<int>());
+        receiveStates.assign(processes, vector<int>());
+        for (int node=0; node<model.numStates(); node++) {
+            if (model.kind[node] == CompiledModel::TERMINAL) {
+                continue;
+            }
+            int reader = owner(node);
+            for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                int neighbor = model.target[e];
+                int writer = owner(neighbor);
+                if (writer == reader || model.kind[neighbor] == CompiledModel::TERMINAL) {
+                    continue;
+                }
+                if (reader == rank) {
+                    receiveStates[writer].push_back(neighbor);
+                } else if (writer == rank) {
+                    sendStates[reader].push_back(neighbor);
+                }
+            }
+        }
+        for (int peer=0; peer<processes; peer++) {
+            sort(sendStates[peer].begin(), sendStates[peer].end());
+            sendStates[peer].erase(unique(sendStates[peer].begin(), sendStates[peer].end()), sendStates[peer].end());
+            sort(receiveStates[peer].begin(), receiveStates[peer].end());
+            receiveStates[peer].erase(unique(receiveStates[peer].begin(), receiveStates[peer].end()), receiveStates[peer].end());
+        }
+    }
+
+    // peers are visited in ascending rank and the lower rank of each pair sends
+    // first, so no two workers ever wait on each other
+    void exchangeHalos(vector<double> &value) {
+        vector<double> buffer;
+        for (int peer=0; peer<processes && ok; peer++) {
+            if (peer == rank) {
+                continue;
+            }
+            for (int turn=0; turn<2 && ok; turn++) {
+                bool sending = (turn == 0) == (rank < peer);
+                if (sending) {
+                    buffer.clear();
+                    for (int node: sendStates[peer]) {
+                        buffer.push_back(value[node]);
+                    }
+                    ok = transport->send(peer, buffer.data(), buffer.size()*sizeof(double));
+                } else {
+                    buffer.resize(receiveStates[peer].size());
+                    ok = transport->receive(peer, buffer.data(), buffer.size()*sizeof(double));
+                    for (int i=0; i<buffer.size() && ok; i++) {
+                        value[receiveStates[peer][i]] = buffer[i];
+                    }
+                }
+            }
+        }
+    }
+
+    long long reduceSum(long long local) {
+        long long total = local;
+        if (rank == 0) {
+            for (int peer=1; peer<processes && ok; peer++) {
+                long long part;
+                ok = transport->receive(peer, &part, sizeof(part));
+                total += part;
+            }
+            for (int peer=1; peer<processes && ok; peer++) {
+                ok = transport->send(peer, &total, sizeof(total));
+            }
+        } else {
+            ok = transport->send(0, &local, sizeof(local)) && transport->receive(0, &total, sizeof(total));
+        }
+        return ok ? total : 0;
+    }
+
+    int sweep(vector<double> &value, const vector<int> &policy) {
+        int count = 0;
+        for (int node=start[rank]; node<start[rank+1]; node++) {
+            if (model.kind[node] == CompiledModel::TERMINAL) {
+                continue;
+            }
+            double currentValue = value[node];
+            auto read = [&value](int neighbor) {
+                return value[neighbor];
+            };
+            int begin = model.offset[node], end = model.offset[node+1];
+            double newValue;
+            if (model.kind[node] == CompiledModel::DECISION) {
+                newValue = decisionBackup(model.reward[node], model.target.data(), begin, end, policy[node],
+                                          model.decisionProb[node], discountFactor, read);
+            } else {
+                newValue = chanceBackup(model.reward[node], model.target.data(), model.weight.data(), begin, end,
+                                        discountFactor, read);
+            }
+
+            value[node] = newValue;
+            if (fabs(newValue - currentValue) <= tolerance) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    int greedyPolicyComputation(const vector<double> &value, vector<int> &policy) {
+        int changed = 0;
+        for (int node=start[rank]; node<start[rank+1]; node++) {
+            if (model.kind[node] != CompiledModel::DECISION) {
+                continue;
+            }
+            int begin = model.offset[node], end = model.offset[node+1];
+            int greedyNeighbor = maximise ? greedyTarget<Maximise>(model.target.data(), begin, end, value)
+                                          : greedyTarget<Minimise>(model.target.data(), begin, end, value);
+            if (greedyNeighbor != policy[node]) {
+                policy[node] = greedyNeighbor;
+                changed++;
+            }
+        }
+        return changed;
+    }
+
+    void work(vector<double> &value, vector<int> &policy) {
+        findHalos();
+        long long changed;
+        do {
+            for (int i=0; i<iterations && ok; i++) {
+                int count = sweep(value, policy);
+                exchangeHalos(value);
+                if (reduceSum(count) == model.numStates()) {
+                    break;
+                }
+            }
+            changed = reduceSum(greedyPolicyComputation(value, policy));
+        } while (changed > 0 && ok);
+
+        // collect every block's values and policies at rank 0
+        int from = start[rank], count = start[rank+1] - start[rank];
+        if (rank != 0) {
+            ok = ok && transport->send(0, &value[from], count*sizeof(double)) &&
+                 transport->send(0, &policy[from], count*sizeof(int));
+            return;
+        }
+        for (int peer=1; peer<processes && ok; peer++) {
+            from = start[peer];
+            count = start[peer+1] - start[peer];
+            ok = transport->receive(peer, &value[from], count*sizeof(double)) &&
+                 transport->receive(peer, &policy[from], count*sizeof(int));
+        }
+    }
+
+public:
+    PartitionedSolver(const CompiledModel &model, Transport *transport, double discountFactor,
+                      int iterations, double tolerance, bool maximise) : model(model) {
+        this->transport = transport;
+        this->processes = max(1, min(transport->size(), model.numStates()));
+        this->discountFactor = discountFactor;
+        this->iterations = iterations;
+        this->tolerance = tolerance;
+        this->maximise = maximise;
+        this->rank = 0;
+        this->ok = true;
+        partition();
+    }
+
+    // runs policy iteration from the given values and policies across the
+    // worker processes and leaves the result in them; false if a worker failed
+    bool solve(vector<double> &value, vector<int> &policy) {
+        cout.flush();
+        vector<pid_t> workers;
+        for (int r=1; r<processes; r++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                rank = r;
+                transport->bind(rank);
+                work(value, policy);
+                _exit(ok ? 0 : 1);
+            }
+            if (pid < 0) {
+                cout<<"Could not start worker process "<<r<<endl;
+                for (pid_t worker: workers) {
+                    kill(worker, SIGKILL);
+                }
+                ok = false;
+                break;
+            }
+            workers.push_back(pid);
+        }
+
+        if (ok) {
+            transport->bind(rank);
+            work(value, policy);
+        }
+
+        // Workers still blocked reading from rank 0 after a failure see end of
+        // file once it closes its ends and then exit; any worker left after
+        // the grace period is killed, so one dead peer cannot hang the solve.
+        if (!ok) {
+            transport->disconnect();
+        }
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(WORKER_GRACE_SECONDS);
+        for (pid_t pid: workers) {
+            int status;
+            while (waitpid(pid, &status, WNOHANG) == 0) {
+                if (chrono::steady_clock::now() > deadline) {
+                    kill(pid, SIGKILL);
+                    waitpid(pid, &status, 0);
+                    break;
+                }
+                usleep(10000);
+            }
+            ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        return ok;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_PARTITIONEDSOLVER_H
@@ -0,0 +1,183 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_POLICYKERNELS_H
+#define MARKOVPROCESSSOLVER_POLICYKERNELS_H
+
+#include "vector"
+#include "algorithm"
+#include "float.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Optimization directions that kernels are instantiated on, so the choice
+// between maximising and minimising is made once per solve instead of on
+// every comparison. better() is strict, so the first of equal scores wins;
+// pick() keeps best unless score is better, lane by lane for the vector forms.
+struct Maximise {
+    static double worst() {
+        return -DBL_MAX;
+    }
+
+    static bool better(double score, double best) {
+        return score > best;
+    }
+
+    static double pick(double score, double best) {
+        return score > best ? score : best;
+    }
+#ifdef __SSE2__
+    static __m128d pick(__m128d score, __m128d best) {
+        return _mm_max_pd(score, best);
+    }
+#endif
+#ifdef __AVX__
+    static __m256d pick(__m256d score, __m256d best) {
+        return _mm256_max_pd(score, best);
+    }
+#endif
+};
+
+struct Minimise {
+    static double worst() {
+        return DBL_MAX;
+    }
+
+    static bool better(double score, double best) {
+        return score < best;
+    }
+
+    static double pick(double score, double best) {
+        return score < best ? score : best;
+    }
+#ifdef __SSE2__
+    static __m128d pick(__m128d score, __m128d best) {
+        return _mm_min_pd(score, best);
+    }
+#endif
+#ifdef __AVX__
+    static __m256d pick(__m256d score, __m256d best) {
+        return _mm256_min_pd(score, best);
+    }
+#endif
+};
+
+// decision nodes with at least this many neighbors are scanned with bestScore
+const int WIDE_DECISION_DEGREE = 16;
+
+// the best of count contiguous scores, or Direction::worst() if none beats it
+template <class Direction>
+double bestScore(const double *score, int count) {
+    double best = Direction::worst();
+    int i = 0;
+#if defined(__AVX__)
+    __m256d lanes = _mm256_set1_pd(best);
+    for (; i+4<=count; i+=4) {
+        lanes = Direction::pick(_mm256_loadu_pd(score + i), lanes);
+    }
+    double lane[4];
+    _mm256_storeu_pd(lane, lanes);
+    for (int k=0; k<4; k++) {
+        best = Direction::pick(lane[k], best);
+    }
+#elif defined(__SSE2__)
+    __m128d lanes = _mm_set1_pd(best);
+    for (; i+2<=count; i+=2) {
+        lanes = Direction::pick(_mm_loadu_pd(score + i), lanes);
+    }
+    double lane[2];
+    _mm_storeu_pd(lane, lanes);
+    best = Direction::pick(lane[1], Direction::pick(lane[0], best));
+#endif
+    for (; i<count; i++) {
+        best = Direction::pick(score[i], best);
+    }
+    return best;
+}
+
+// The neighbor among target[begin..end) with the best score, -1 if there is
+// none. Wide nodes gather their neighbors' scores into a buffer, reduce it
+// with bestScore and then take the first neighbor holding that score, which
+// is the one a first-wins scan would pick.
+template <class Direction>
+int greedyTarget(const int *target, int begin, int end, const vector<double> &score) {
+    if (end - begin >= WIDE_DECISION_DEGREE) {
+        static thread_local vector<double> gathered;
+        int count = end - begin;
+        gathered.resize(count);
+        for (int i=0; i<count; i++) {
+            gathered[i] = score[target[begin + i]];
+        }
+        double best = bestScore<Direction>(gathered.data(), count);
+        if (!Direction::better(best, Direction::worst())) {
+            return -1;
+        }
+        int i = 0;
+        while (gathered[i] != best) {
+            i++;
+        }
+        return target[begin + i];
+    }
+
+    int greedy = -1;
+    double greedyScore = Direction::worst();
+    for (int e=begin; e<end; e++) {
+        double candidate = score[target[e]];
+        if (Direction::better(candidate, greedyScore)) {
+            greedyScore = candidate;
+            greedy = target[e];
+        }
+    }
+    return greedy;
+}
+
+// The backup of a decision node over target[begin..end) under its chosen
+// neighbor: the chosen neighbor gets p of the discounted value and the others
+// share the rest. Both terms are formed for every edge and one is selected,
+// which keeps the loop free of data-dependent branches. read(s) is the value
+// of state s, so solvers with other value stores share the same arithmetic.
+template <class Read>
+double decisionBackup(double reward, const int *target, int begin, int end, int chosen, double p,
+                      double discountFactor, Read read) {
+    double newValue = reward;
+    int degree = end - begin;
+    double chosenShare = discountFactor*p;
+    double otherShare = degree > 1 ? discountFactor*(1.0 - p) : 0.0;
+    int others = max(1, degree - 1);
+    for (int e=begin; e<end; e++) {
+        int neighbor = target[e];
+        double neighborValue = read(neighbor);
+        double chosenTerm = chosenShare*neighborValue;
+        double otherTerm = (otherShare*neighborValue)/others;
+        newValue += neighbor == chosen ? chosenTerm : otherTerm;
+    }
+    return newValue;
+}
+
+// the backup of a chance node, weight[e] being the probability of edge e
+template <class Read>
+double chanceBackup(double reward, const int *target, const double *weight, int begin, int end,
+                    double discountFactor, Read read) {
+    double newValue = reward;
+    for (int e=begin; e<end; e++) {
+        newValue += discountFactor*weight[e]*read(target[e]);
+    }
+    return newValue;
+}
+
+// The largest update at which an evaluation may treat the values as settled.
+// When no state is more than this from its next backup, every value is within
+// it/(1 - discountFactor), the tolerance, of the policy's fixed point. A
+// discount factor of 1 gives no such bound, and the tolerance itself is used.
+inline double settledChange(double discountFactor, double tolerance) {
+    return discountFactor < 1.0 ? (1.0 - discountFactor)*tolerance : tolerance;
+}
+
+#endif //MARKOVPROCESSSOLVER_POLICYKERNELS_H
@@ -0,0 +1,243 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_POLICYSIMULATOR_H
+#define MARKOVPROCESSSOLVER_POLICYSIMULATOR_H
+
+#include "CompiledModel.h"
+#include "WorkStealingScheduler.h"
+#include "vector"
+#include "algorithm"
+#include "functional"
+#include <stdint.h>
+#include <math.h>
+
+using namespace std;
+
+// Monte Carlo rollouts of a fixed policy over the compiled model, to check a
+// solution's values independently of the solver. A trajectory collects the
+// discounted reward of every state it visits and stops at a terminal state,
+// after the horizon, or when a node's probabilities leave some mass unused
+// (a decision node's single edge with p < 1). Every state's next step is
+// drawn from an alias table built once from the model and the policy, so a
+// step costs one random number and one table lookup.
+//
+// Random numbers come from a counter-based generator keyed by trajectory and
+// step, and trajectories are summed in fixed batches, so the estimates do
+// not depend on the number of threads or on which thread ran a batch.
+class PolicySimulator {
+
+public:
+    struct Estimate {
+        int state;
+        long long trajectories, cutOff;
+        double mean, halfWidth;
+    };
+
+private:
+    // one column of a state's alias table: the column's own outcome is taken
+    // below threshold, the alias outcome above it; -1 stops the trajectory
+    struct Column {
+        double threshold;
+        int target, aliasTarget;
+    };
+
+    struct Batch {
+        double sum, sumOfSquares;
+        long long cutOff;
+    };
+
+    static const int BATCH = 1024;
+
+    const CompiledModel &model;
+    double discountFactor;
+    int horizon;
+    uint64_t seed;
+    vector<int> columnOffset;
+    vector<Column> columns;
+
+    // SplitMix64's output function, a bijection that scrambles every bit
+    static uint64_t mix(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27))*0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    // Vose's alias method over a state's outcomes: its edges, then stopping
+    void buildTable(int node, const vector<double> &outcomeProb) {
+        int k = outcomeProb.size();
+        int first = columnOffset[node];
+        vector<double> scaled(k);
+        vector<int> small, large;
+        for (int i=0; i<k; i++) {
+            scaled[i] = outcomeProb[i]*k;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        auto outcome = [this, node, k](int i) {
+            return i == k-1 ? -1 : model.target[model.offset[node] + i];
+        };
+        for (int i=0; i<k; i++) {
+            columns[first + i].target = outcome(i);
+            columns[first + i].aliasTarget = outcome(i);
+            columns[first + i].threshold = 1.0;
+        }
+        while (!small.empty() && !large.empty()) {
+            int low = small.back(), high = large.back();
+            small.pop_back();
+            columns[first + low].threshold = scaled[low];
+            columns[first + low].aliasTarget = outcome(high);
+            scaled[high] -= 1.0 - scaled[low];
+            if (scaled[high] < 1.0) {
+                large.pop_back();
+                small.push_back(high);
+            }
+        }
+    }
+
+    // discounted return of one trajectory from start, and whether the horizon cut it off
+    double rollout(int start, uint64_t trajectory, bool &cutOff) {
+        uint64_t key = mix(seed ^ mix(trajectory));
+        double total = 0.0, discount = 1.0;
+        int state = start;
+        for (int step=0; step<horizon; step++) {
+            total += discount*model.reward[state];
+            if (model.kind[state] == CompiledModel::TERMINAL) {
+                return total;
+            }
+            int k = columnOffset[state+1] - columnOffset[state];
+            double u = (mix(key + step) >> 11)*(1.0/9007199254740992.0)*k;
+            int i = (int) u;
+            const Column &column = columns[columnOffset[state] + i];
+            state = u - i < column.threshold ? column.target : column.aliasTarget;
+            if (state < 0) {
+                return total;
+            }
+            discount *= discountFactor;
+        }
+        cutOff = true;
+        return total;
+    }
+
+public:
+    // horizon bounds the steps of a trajectory; with a discount factor below 1
+    // it is lowered to where the remaining discount drops under 1e-12
+    PolicySimulator(const CompiledModel &model, const vector<int> &policy, double discountFactor,
+                    int horizon, uint64_t seed) : model(model) {
+        this->discountFactor = discountFactor;
+        this->horizon = horizon;
+        if (discountFactor < 1.0 && discountFactor > 0.0) {
+            this->horizon = min(horizon, (int) ceil(log(1e-12)/log(discountFactor)) + 1);
+        }
+        this->seed = seed;
+
+        int n = model.numStates();
+        columnOffset.assign(n + 1, 0);
+        for (int node=0; node<n; node++) {
+            int outcomes = model.kind[node] == CompiledModel::TERMINAL ? 0 : model.degree(node) + 1;
+            columnOffset[node+1] = columnOffset[node] + outcomes;
+        }
+        columns.resize(columnOffset[n]);
+
+        vector<double> outcomeProb;
+        for (int node=0; node<n; node++) {
+            if (model.kind[node] == CompiledModel::TERMINAL) {
+                continue;
+            }
+            int degree = model.degree(node);
+            outcomeProb.assign(degree + 1, 0.0);
+            double p = model.decisionProb[node];
+            double total = 0.0;
+            for (int i=0; i<degree; i++) {
+                int e = model.offset[node] + i;
+                if (model.kind[node] == CompiledModel::DECISION) {
+                    outcomeProb[i] = model.target[e] == policy[node] ? p : (degree > 1 ? (1.0 - p)/(degree - 1) : 0.0);
+                } else {
+                    outcomeProb[i] = model.weight[e];
+                }
+                total += outcomeProb[i];
+            }
+            if (total > 1.0) {
+                for (int i=0; i<degree; i++) {
+                    outcomeProb[i] /= total;
+                }
+            } else {
+                outcomeProb[degree] = 1.0 - total;
+            }
+            buildTable(node, outcomeProb);
+        }
+    }
+
+    // bytes of the alias tables for a model and of the batch sums of a run
+    static long long bytesFor(const CompiledModel &model, long long starts, long long trajectories) {
+        long long outcomes = 0;
+        for (int node=0; node<model.numStates(); node++) {
+            if (model.kind[node] != CompiledModel::TERMINAL) {
+                outcomes += model.degree(node) + 1;
+            }
+        }
+        long long batches = starts*((trajectories + BATCH - 1)/BATCH);
+        return (model.numStates() + 1)*sizeof(int) + outcomes*sizeof(Column) + batches*sizeof(Batch);
+    }
+
+    // simulates trajectories from each of starts, on the scheduler's threads if
+    // one is given, and estimates each start's value with a 95% confidence interval
+    vector<Estimate> run(const vector<int> &starts, long long trajectories, WorkStealingScheduler *scheduler) {
+        long long batchesPerStart = (trajectories + BATCH - 1)/BATCH;
+        long long totalBatches = batchesPerStart*starts.size();
+        vector<Batch> batches(totalBatches);
+        auto simulateBatch = [&](long long b) {
+            int start = b/batchesPerStart;
+            long long first = (b % batchesPerStart)*BATCH;
+            long long last = min(trajectories, first + BATCH);
+            Batch batch = {0.0, 0.0, 0};
+            for (long long t=first; t<last; t++) {
+                bool cutOff = false;
+                double total = rollout(starts[start], (uint64_t) start*trajectories + t, cutOff);
+                batch.sum += total;
+                batch.sumOfSquares += total*total;
+                batch.cutOff += cutOff;
+            }
+            batches[b] = batch;
+        };
+        if (scheduler) {
+            // one chunk per batch; the scheduler's chunks are int ranges
+            vector<pair<int, int>> chunks;
+            for (long long b=0; b<totalBatches; b++) {
+                chunks.push_back(make_pair(b, b+1));
+            }
+            scheduler->run(chunks, [&](int begin, int end, int) {
+                for (long long b=begin; b<end; b++) {
+                    simulateBatch(b);
+                }
+            });
+        } else {
+            for (long long b=0; b<totalBatches; b++) {
+                simulateBatch(b);
+            }
+        }
+
+        vector<Estimate> estimates;
+        for (int s=0; s<starts.size(); s++) {
+            double sum = 0.0, sumOfSquares = 0.0;
+            long long cutOff = 0;
+            for (long long b=s*batchesPerStart; b<(s+1)*batchesPerStart; b++) {
+                sum += batches[b].sum;
+                sumOfSquares += batches[b].sumOfSquares;
+                cutOff += batches[b].cutOff;
+            }
+            Estimate estimate;
+            estimate.state = starts[s];
+            estimate.trajectories = trajectories;
+            estimate.cutOff = cutOff;
+            estimate.mean = sum/trajectories;
+            double variance = trajectories > 1 ? max(0.0, (sumOfSquares - sum*estimate.mean)/(trajectories - 1)) : 0.0;
+            estimate.halfWidth = 1.96*sqrt(variance/trajectories);
+            estimates.push_back(estimate);
+        }
+        return estimates;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_POLICYSIMULATOR_H
@@ -0,0 +1,87 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_REWARDSENSITIVITY_H
+#define MARKOVPROCESSSOLVER_REWARDSENSITIVITY_H
+
+#include "CompiledModel.h"
+#include "vector"
+#include "algorithm"
+#include <math.h>
+
+using namespace std;
+
+// Gradients of one state's value with respect to every state's reward, for a
+// fixed policy. The values solve v = r + df*P*v, where P holds the policy's
+// transition probabilities and terminal states have no row, so the gradient
+// of v[q] is row q of (I - df*P)^-1: the solution of the transposed (adjoint)
+// system g = e_q + df*P^T*g. That is one evaluation-sized solve per queried
+// state, however many rewards there are.
+class RewardSensitivity {
+
+private:
+    const CompiledModel &model;
+    // the transposed matrix in CSR form: state j receives coefficient[e]*g[source[e]]
+    vector<int> offset, source;
+    vector<double> coefficient;
+
+public:
+    // coefficients are those of the solver's backup, discount factor included
+    RewardSensitivity(const CompiledModel &model, const vector<int> &policy, double discountFactor) : model(model) {
+        int n = model.numStates();
+        offset.assign(n + 1, 0);
+        for (int e=0; e<model.target.size(); e++) {
+            offset[model.target[e] + 1]++;
+        }
+        for (int s=0; s<n; s++) {
+            offset[s+1] += offset[s];
+        }
+        source.resize(offset[n]);
+        coefficient.resize(offset[n]);
+
+        vector<int> fillAt(offset.begin(), offset.end() - 1);
+        for (int node=0; node<n; node++) {
+            int degree = model.degree(node);
+            double p = model.decisionProb[node];
+            for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                double c;
+                if (model.kind[node] == CompiledModel::DECISION) {
+                    double otherShare = degree > 1 ? discountFactor*(1.0 - p) : 0.0;
+                    c = model.target[e] == policy[node] ? discountFactor*p : otherShare/max(1, degree - 1);
+                } else {
+                    c = discountFactor*model.weight[e];
+                }
+                int at = fillAt[model.target[e]]++;
+                source[at] = node;
+                coefficient[at] = c;
+            }
+        }
+    }
+
+    // d value[state] / d reward[s] for every s, by Gauss-Seidel sweeps of the
+    // adjoint system until no entry moves by more than the tolerance or the
+    // sweeps run out
+    vector<double> gradient(int state, double tolerance, int iterations) {
+        int n = model.numStates();
+        vector<double> g(n, 0.0);
+        g[state] = 1.0;
+        for (int sweep=0; sweep<iterations; sweep++) {
+            double residual = 0.0;
+            for (int j=0; j<n; j++) {
+                double next = j == state ? 1.0 : 0.0;
+                for (int e=offset[j]; e<offset[j+1]; e++) {
+                    next += coefficient[e]*g[source[e]];
+                }
+                residual = max(residual, abs(next - g[j]));
+                g[j] = next;
+            }
+            if (residual <= tolerance) {
+                break;
+            }
+        }
+        return g;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_REWARDSENSITIVITY_H
@@ -0,0 +1,98 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+// Times a sweep-like pass over a graph with a heavy-tailed degree
+// distribution, once with a static split of the states into one equal-sized
+// range per thread and once with the work-stealing scheduler over chunks of
+// equal edge count, for 1, 2, 4, ... threads.
+//
+//   SchedulerBenchmark [states] [max threads] [repeats]
+
+#include "WorkStealingScheduler.h"
+#include "iostream"
+#include "iomanip"
+#include "chrono"
+#include "random"
+#include "algorithm"
+
+using namespace std;
+
+// Most states have a handful of edges; one in a thousand is a hub with
+// thousands. The hubs sit together at the front of the numbering, the way
+// states named after the same region end up next to each other.
+void buildGraph(int n, vector<int> &offset, vector<int> &target) {
+    mt19937 random(42);
+    uniform_int_distribution<int> anyState(0, n-1), smallDegree(2, 6), hubDegree(1000, 5000);
+    int hubs = max(1, n/1000);
+    offset.assign(1, 0);
+    target.clear();
+    for (int s=0; s<n; s++) {
+        int degree = s < hubs ? hubDegree(random) : smallDegree(random);
+        for (int e=0; e<degree; e++) {
+            target.push_back(anyState(random));
+        }
+        offset.push_back(target.size());
+    }
+}
+
+// one pass of value[s] = 0.5*value[s] + 0.5*mean of the neighbors, writing
+// to next, with the work cut into the given chunks; returns the seconds taken
+double timePass(WorkStealingScheduler &scheduler, const vector<pair<int, int>> &chunks, const vector<int> &offset,
+                const vector<int> &target, const vector<double> &value, vector<double> &next) {
+    function<void(int, int, int)> body = [&](int begin, int end, int) {
+        for (int s=begin; s<end; s++) {
+            double sum = 0.0;
+            for (int e=offset[s]; e<offset[s+1]; e++) {
+                sum += value[target[e]];
+            }
+            next[s] = 0.5*value[s] + 0.5*sum/(offset[s+1] - offset[s]);
+        }
+    };
+    auto start = chrono::steady_clock::now();
+    scheduler.run(chunks, body);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : max(1, (int) thread::hardware_concurrency());
+    int repeats = argc > 3 ? atoi(argv[3]) : 10;
+
+    vector<int> offset, target;
+    buildGraph(n, offset, target);
+    vector<double> value(n, 1.0), next(n);
+    cout<<n<<" states, "<<target.size()<<" edges, best of "<<repeats<<" passes"<<endl;
+    cout<<"threads    static ms  stealing ms  static speedup  stealing speedup  static imbalance"<<endl;
+
+    double staticBase = 0.0, stealingBase = 0.0;
+    for (int threads=1; threads<=maxThreads; threads*=2) {
+        WorkStealingScheduler scheduler(threads);
+
+        // one range of n/threads states per thread; with a single chunk in
+        // each queue there is nothing left to steal, and the speedup can be
+        // at most threads over the largest range's share of the work
+        vector<pair<int, int>> staticChunks;
+        long long largest = 0;
+        for (int t=0; t<threads; t++) {
+            staticChunks.push_back(make_pair((long long) t*n/threads, (long long) (t+1)*n/threads));
+            int begin = staticChunks.back().first, end = staticChunks.back().second;
+            largest = max(largest, (long long) end - begin + offset[end] - offset[begin]);
+        }
+        double imbalance = (double) largest*threads/(n + offset[n]);
+        vector<pair<int, int>> stealingChunks = WorkStealingScheduler::chunksByCost(offset, 8*threads);
+
+        double staticBest = 1e18, stealingBest = 1e18;
+        for (int r=0; r<repeats; r++) {
+            staticBest = min(staticBest, timePass(scheduler, staticChunks, offset, target, value, next));
+            stealingBest = min(stealingBest, timePass(scheduler, stealingChunks, offset, target, value, next));
+        }
+        if (threads == 1) {
+            staticBase = staticBest;
+            stealingBase = stealingBest;
+        }
+        cout<<setw(7)<<threads<<fixed<<setprecision(2)<<setw(13)<<staticBest*1000<<setw(13)<<stealingBest*1000
+            <<setw(16)<<staticBase/staticBest<<setw(18)<<stealingBase/stealingBest<<setw(18)<<imbalance<<endl;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_SOLVEOBSERVER_H
+#define MARKOVPROCESSSOLVER_SOLVEOBSERVER_H
+
+#include "string"
+#include "fstream"
+#include "iostream"
+#include "chrono"
+
+using namespace std;
+
+// Told about the progress of a solve: once after every evaluation sweep and
+// once after every policy improvement. Calls come from the solving thread
+// between sweeps, never from inside one, so an observer costs nothing per
+// state and a solve without observers skips them entirely.
+class SolveObserver {
+public:
+    virtual ~SolveObserver() {}
+
+    // sweep counts from 0 within every round; residual is the largest change
+    virtual void sweepDone(int /*round*/, int /*sweep*/, double /*residual*/) {}
+
+    virtual void roundDone(int /*round*/, int /*policyChanges*/) {}
+};
+
+// Prints a progress line to stderr at most once every interval seconds, and
+// one after every round, so stdout keeps only the solution.
+class ProgressPrinter : public SolveObserver {
+private:
+    double interval;
+    chrono::steady_clock::time_point start, lastPrinted;
+
+    double elapsed() {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    ProgressPrinter(double interval) {
+        this->interval = interval;
+        start = chrono::steady_clock::now();
+        lastPrinted = start;
+    }
+
+    void sweepDone(int round, int sweep, double residual) {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (chrono::duration<double>(now - lastPrinted).count() < interval) {
+            return;
+        }
+        lastPrinted = now;
+        cerr<<"["<<elapsed()<<"s] round "<<round<<" sweep "<<sweep<<" residual "<<residual<<endl;
+    }
+
+    void roundDone(int round, int policyChanges) {
+        cerr<<"["<<elapsed()<<"s] round "<<round<<" done, "<<policyChanges<<" policy changes"<<endl;
+    }
+};
+
+// Writes every sweep's residual to a file as "round sweep residual" lines,
+// and every round's policy changes as "round changes" lines prefixed with #.
+class ResidualTrace : public SolveObserver {
+private:
+    ofstream file;
+
+public:
+    ResidualTrace(const string &path) : file(path) {
+        if (!file) {
+            cout<<"Cannot write residual trace: "<<path<<endl;
+        }
+        file.precision(17);
+    }
+
+    void sweepDone(int round, int sweep, double residual) {
+        file<<round<<" "<<sweep<<" "<<residual<<"\n";
+    }
+
+    void roundDone(int round, int policyChanges) {
+        file<<"# "<<round<<" "<<policyChanges<<"\n";
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_SOLVEOBSERVER_H
@@ -0,0 +1,368 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_SOLVERDAEMON_H
+#define MARKOVPROCESSSOLVER_SOLVERDAEMON_H
+
+#include "MarkovProcessSolver.h"
+#include "thread"
+#include "mutex"
+#include "condition_variable"
+#include "atomic"
+#include "set"
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+// Keeps models loaded between requests and answers a line-oriented protocol,
+// on stdin/stdout or on a Unix domain socket (one thread per connection):
+//
+//   load <model> <input file>                  -> ok loaded <states> states
+//   solve <model> [-df d] [-tol t] [-iter n] [-min]
+//                                              -> ok cached | ok solving
+//   wait <model>                               -> ok ready
+//   value <model> <state>                      -> ok <value>
+//   policy <model> <state>                     -> ok <neighbor>
+//   quit                                       -> ends this session
+//   shutdown                                   -> stops the daemon
+//
+// Failures answer "error <reason>". A solve whose arguments match the cached
+// solution is answered from the cache; otherwise the model is solved again
+// on a background thread while value and policy keep answering from the
+// previous solution.
+class SolverDaemon {
+
+private:
+    struct LoadedModel {
+        MarkovProcessSolver *loaded;
+        MarkovProcessSolver *solution;
+        ProgramArguments solutionArguments, requestedArguments;
+        bool solving;
+        thread worker;
+        condition_variable done;
+    };
+
+    map<string, LoadedModel*> models;
+    mutex lock;
+    int listener;
+    atomic<bool> stopped;
+    // socket sessions: their threads, the clients still open and the
+    // threads that have finished and can be joined
+    vector<thread> connections;
+    set<int> clients;
+    vector<thread::id> closed;
+    mutex connectionLock;
+
+    static bool sameArguments(const ProgramArguments &a, const ProgramArguments &b) {
+        return a.discountFactor == b.discountFactor && a.tolerance == b.tolerance &&
+               a.iterations == b.iterations && a.maximise == b.maximise;
+    }
+
+    // solves until the latest requested arguments have a solution
+    void solveInBackground(LoadedModel *model) {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            ProgramArguments arguments = model->requestedArguments;
+            guard.unlock();
+            MarkovProcessSolver *solution = new MarkovProcessSolver(*model->loaded, &arguments);
+            solution->solve(false);
+            guard.lock();
+
+            delete model->solution;
+            model->solution = solution;
+            model->solutionArguments = arguments;
+            if (sameArguments(model->requestedArguments, arguments)) {
+                break;
+            }
+        }
+        model->solving = false;
+        model->done.notify_all();
+    }
+
+    string load(const string &name, const string &inputFile) {
+        ProgramArguments arguments;
+        arguments.inputFile = inputFile;
+        MarkovProcessSolver *loaded = new MarkovProcessSolver(&arguments);
+        // a file that cannot be opened reads as an empty model
+        if (!loaded->hasValidInput() || loaded->numStates() == 0) {
+            delete loaded;
+            return "error cannot load " + inputFile;
+        }
+
+        unique_lock<mutex> guard(lock);
+        if (models.find(name) != models.end()) {
+            delete loaded;
+            return "error model " + name + " is already loaded";
+        }
+        LoadedModel *model = new LoadedModel();
+        model->loaded = loaded;
+        model->solution = nullptr;
+        model->solving = false;
+        models[name] = model;
+        return "ok loaded " + to_string(loaded->numStates()) + " states";
+    }
+
+    string solve(LoadedModel *model, const vector<string> &tokens) {
+        ProgramArguments arguments;
+        for (int i=2; i<tokens.size(); i++) {
+            // a malformed number must not take the daemon down
+            try {
+                if (tokens[i] == "-min") {
+                    arguments.maximise = false;
+                } else if (i+1<tokens.size() && tokens[i] == "-df") {
+                    arguments.discountFactor = stod(tokens[++i]);
+                } else if (i+1<tokens.size() && tokens[i] == "-tol") {
+                    arguments.tolerance = stod(tokens[++i]);
+                } else if (i+1<tokens.size() && tokens[i] == "-iter") {
+                    arguments.iterations = stoi(tokens[++i]);
+                } else {
+                    return "error unknown solve argument " + tokens[i];
+                }
+            } catch (const exception &e) {
+                return "error bad number " + tokens[i];
+            }
+        }
+
+        unique_lock<mutex> guard(lock);
+        if (model->solution != nullptr && sameArguments(model->solutionArguments, arguments) &&
+            (!model->solving || sameArguments(model->requestedArguments, arguments))) {
+            return "ok cached";
+        }
+        model->requestedArguments = arguments;
+        if (!model->solving) {
+            model->solving = true;
+            if (model->worker.joinable()) {
+                model->worker.join();
+            }
+            model->worker = thread(&SolverDaemon::solveInBackground, this, model);
+        }
+        return "ok solving";
+    }
+
+    string handle(const string &line) {
+        vector<string> tokens;
+        stringstream ss(line);
+        string token;
+        while (ss>>token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) {
+            return "error empty request";
+        }
+
+        string command = tokens[0];
+        if (command == "load") {
+            return tokens.size() == 3 ? load(tokens[1], tokens[2]) : "error usage: load <model> <input file>";
+        }
+        if (tokens.size() < 2) {
+            return "error usage: " + command + " <model> ...";
+        }
+
+        unique_lock<mutex> guard(lock);
+        auto itr = models.find(tokens[1]);
+        if (itr == models.end()) {
+            return "error unknown model " + tokens[1];
+        }
+        LoadedModel *model = itr->second;
+
+        if (command == "solve") {
+            guard.unlock();
+            return solve(model, tokens);
+        } else if (command == "wait") {
+            model->done.wait(guard, [model] { return !model->solving; });
+            return model->solution == nullptr ? "error model " + tokens[1] + " was never solved" : "ok ready";
+        } else if (command == "value" || command == "policy") {
+            if (tokens.size() != 3) {
+                return "error usage: " + command + " <model> <state>";
+            }
+            if (model->solution == nullptr) {
+                return "error model " + tokens[1] + " is not solved yet";
+            }
+            if (command == "value") {
+                double value = model->solution->valueOf(tokens[2]);
+                if (value != value) {
+                    return "error unknown state " + tokens[2];
+                }
+                ostringstream answer;
+                answer<<"ok "<<value;
+                return answer.str();
+            }
+            string neighbor = model->solution->policyOf(tokens[2]);
+            return neighbor.empty() ? "error " + tokens[2] + " is not a decision node" : "ok " + neighbor;
+        }
+        return "error unknown command " + command;
+    }
+
+    // answers one client until it quits; returns true if it asked for shutdown
+    bool session(istream &in, ostream &out) {
+        string line;
+        while (getline(in, line)) {
+            MarkovProcessSolver::removeLeadingAndTrailingWhitespace(line);
+            if (line == "quit") {
+                return false;
+            }
+            if (line == "shutdown") {
+                out<<"ok"<<endl;
+                return true;
+            }
+            out<<handle(line)<<endl;
+        }
+        return false;
+    }
+
+    // a minimal streambuf over a connected socket, so sessions can use iostreams
+    class SocketBuffer : public streambuf {
+    private:
+        int fd;
+        char input[4096], output[4096];
+
+    protected:
+        int underflow() {
+            ssize_t received = read(fd, input, sizeof(input));
+            if (received <= 0) {
+                return EOF;
+            }
+            setg(input, input, input + received);
+            return (unsigned char) input[0];
+        }
+
+        int overflow(int ch) {
+            if (sync() != 0) {
+                return EOF;
+            }
+            if (ch != EOF) {
+                *pptr() = ch;
+                pbump(1);
+            }
+            return ch == EOF ? 0 : ch;
+        }
+
+        int sync() {
+            char *at = pbase();
+            while (at < pptr()) {
+                ssize_t sent = ::send(fd, at, pptr() - at, MSG_NOSIGNAL);
+                if (sent <= 0) {
+                    return -1;
+                }
+                at += sent;
+            }
+            setp(output, output + sizeof(output) - 1);
+            return 0;
+        }
+
+    public:
+        SocketBuffer(int fd) {
+            this->fd = fd;
+            setg(input, input, input);
+            setp(output, output + sizeof(output) - 1);
+        }
+    };
+
+    void connection(int client) {
+        SocketBuffer buffer(client);
+        istream in(&buffer);
+        ostream out(&buffer);
+        if (session(in, out)) {
+            stopped = true;
+            ::shutdown(listener, SHUT_RDWR);
+        }
+        out.flush();
+        unique_lock<mutex> guard(connectionLock);
+        clients.erase(client);
+        close(client);
+        closed.push_back(this_thread::get_id());
+    }
+
+    // joins the sessions that have ended; connectionLock must be held
+    void joinClosed() {
+        for (thread::id id: closed) {
+            for (int i=0; i<connections.size(); i++) {
+                if (connections[i].get_id() == id) {
+                    connections[i].join();
+                    connections.erase(connections.begin() + i);
+                    break;
+                }
+            }
+        }
+        closed.clear();
+    }
+
+public:
+    SolverDaemon() {
+        this->listener = -1;
+        this->stopped = false;
+    }
+
+    ~SolverDaemon() {
+        for (auto itr = models.begin(); itr!=models.end(); itr++) {
+            if (itr->second->worker.joinable()) {
+                itr->second->worker.join();
+            }
+            delete itr->second->loaded;
+            delete itr->second->solution;
+            delete itr->second;
+        }
+    }
+
+    // loads a model before serving, as if a client had sent "load"
+    void preload(const string &name, const string &inputFile) {
+        streambuf *output = cout.rdbuf(cerr.rdbuf());
+        cerr<<handle("load " + name + " " + inputFile)<<endl;
+        cout.rdbuf(output);
+    }
+
+    // the solvers write their messages to cout, so on stdin/stdout they are
+    // sent to stderr instead, leaving stdout to the answers
+    void serve() {
+        ostream answers(cout.rdbuf());
+        streambuf *output = cout.rdbuf(cerr.rdbuf());
+        session(cin, answers);
+        cout.rdbuf(output);
+    }
+
+    void serve(const string &socketPath) {
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+        unlink(socketPath.c_str());
+        if (listener < 0 || ::bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+            cout<<"Cannot listen on socket: "<<socketPath<<endl;
+            return;
+        }
+
+        while (!stopped) {
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0) {
+                break;
+            }
+            unique_lock<mutex> guard(connectionLock);
+            joinClosed();
+            clients.insert(client);
+            connections.push_back(thread(&SolverDaemon::connection, this, client));
+        }
+
+        // end the other sessions and wait for them, so none is still using a
+        // model when the daemon deletes them
+        {
+            unique_lock<mutex> guard(connectionLock);
+            for (int client: clients) {
+                ::shutdown(client, SHUT_RDWR);
+            }
+        }
+        for (thread& connection: connections) {
+            connection.join();
+        }
+        connections.clear();
+        closed.clear();
+        close(listener);
+        unlink(socketPath.c_str());
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_SOLVERDAEMON_H
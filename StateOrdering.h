@@ -0,0 +1,185 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_STATEORDERING_H
+#define MARKOVPROCESSSOLVER_STATEORDERING_H
+
+#include "CompiledModel.h"
+#include "vector"
+#include "algorithm"
+
+using namespace std;
+
+// State numberings that place states sharing an edge close together, so a
+// sweep reads neighbor values that are still in cache. Each returns newToOld
+// for CompiledModel::reorder. Edges count in both directions, and every
+// connected component is numbered before the next one starts. byKind instead
+// groups states by node kind, for kernels that run once per kind.
+class StateOrdering {
+
+private:
+    struct Graph {
+        vector<int> offset, neighbor;
+
+        int degree(int node) const {
+            return offset[node+1] - offset[node];
+        }
+    };
+
+    static Graph undirected(const CompiledModel &model) {
+        int n = model.numStates();
+        Graph graph;
+        graph.offset.assign(n + 1, 0);
+        for (int node=0; node<n; node++) {
+            for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                graph.offset[node + 1]++;
+                graph.offset[model.target[e] + 1]++;
+            }
+        }
+        for (int node=0; node<n; node++) {
+            graph.offset[node+1] += graph.offset[node];
+        }
+        graph.neighbor.resize(graph.offset[n]);
+        vector<int> fillAt(graph.offset.begin(), graph.offset.end() - 1);
+        for (int node=0; node<n; node++) {
+            for (int e=model.offset[node]; e<model.offset[node+1]; e++) {
+                graph.neighbor[fillAt[node]++] = model.target[e];
+                graph.neighbor[fillAt[model.target[e]]++] = node;
+            }
+        }
+        return graph;
+    }
+
+    // breadth-first search from root; returns the number of levels below root
+    // and leaves the deepest level in last
+    static int deepestLevel(const Graph &graph, int root, vector<int> &mark, int stamp, vector<int> &last) {
+        vector<int> level(1, root), next;
+        mark[root] = stamp;
+        int depth = 0;
+        while (true) {
+            next.clear();
+            for (int node: level) {
+                for (int e=graph.offset[node]; e<graph.offset[node+1]; e++) {
+                    if (mark[graph.neighbor[e]] != stamp) {
+                        mark[graph.neighbor[e]] = stamp;
+                        next.push_back(graph.neighbor[e]);
+                    }
+                }
+            }
+            if (next.empty()) {
+                last.swap(level);
+                return depth;
+            }
+            level.swap(next);
+            depth++;
+        }
+    }
+
+    // a state of about maximal eccentricity in start's component (George-Liu):
+    // keep moving to the lowest degree state of the deepest level while that
+    // makes the search deeper
+    static int peripheralState(const Graph &graph, int start, vector<int> &mark, int &stamp) {
+        vector<int> last, candidateLast;
+        int root = start;
+        int depth = deepestLevel(graph, root, mark, ++stamp, last);
+        while (true) {
+            int candidate = last[0];
+            for (int node: last) {
+                if (graph.degree(node) < graph.degree(candidate)) {
+                    candidate = node;
+                }
+            }
+            int candidateDepth = deepestLevel(graph, candidate, mark, ++stamp, candidateLast);
+            if (candidateDepth <= depth) {
+                return root;
+            }
+            root = candidate;
+            depth = candidateDepth;
+            last.swap(candidateLast);
+        }
+    }
+
+public:
+    // breadth-first from the lowest unnumbered id, neighbors in edge order
+    static vector<int> breadthFirst(const CompiledModel &model) {
+        int n = model.numStates();
+        Graph graph = undirected(model);
+        vector<bool> numbered(n, false);
+        vector<int> order;
+        order.reserve(n);
+        for (int start=0; start<n; start++) {
+            if (numbered[start]) {
+                continue;
+            }
+            numbered[start] = true;
+            order.push_back(start);
+            for (int i=order.size()-1; i<order.size(); i++) {
+                int node = order[i];
+                for (int e=graph.offset[node]; e<graph.offset[node+1]; e++) {
+                    if (!numbered[graph.neighbor[e]]) {
+                        numbered[graph.neighbor[e]] = true;
+                        order.push_back(graph.neighbor[e]);
+                    }
+                }
+            }
+        }
+        return order;
+    }
+
+    // terminal, then decision, then chance states, each in name order, so that
+    // every kind is a single range of ids
+    static vector<int> byKind(const CompiledModel &model) {
+        vector<int> order;
+        order.reserve(model.numStates());
+        for (int kind=CompiledModel::TERMINAL; kind<=CompiledModel::CHANCE; kind++) {
+            for (int node=0; node<model.numStates(); node++) {
+                if (model.kind[node] == kind) {
+                    order.push_back(node);
+                }
+            }
+        }
+        return order;
+    }
+
+    // Reverse Cuthill-McKee: breadth-first from a peripheral state, visiting
+    // neighbors by increasing degree, then reversed. Keeps the bandwidth of the
+    // transition matrix small.
+    static vector<int> reverseCuthillMcKee(const CompiledModel &model) {
+        int n = model.numStates();
+        Graph graph = undirected(model);
+        vector<int> mark(n, 0);
+        int stamp = 0;
+        vector<bool> numbered(n, false);
+        vector<int> order, fresh;
+        order.reserve(n);
+        auto byDegree = [&graph](int a, int b) {
+            return graph.degree(a) < graph.degree(b) || (graph.degree(a) == graph.degree(b) && a < b);
+        };
+
+        for (int start=0; start<n; start++) {
+            if (numbered[start]) {
+                continue;
+            }
+            int root = peripheralState(graph, start, mark, stamp);
+            numbered[root] = true;
+            order.push_back(root);
+            for (int i=order.size()-1; i<order.size(); i++) {
+                int node = order[i];
+                fresh.clear();
+                for (int e=graph.offset[node]; e<graph.offset[node+1]; e++) {
+                    if (!numbered[graph.neighbor[e]]) {
+                        numbered[graph.neighbor[e]] = true;
+                        fresh.push_back(graph.neighbor[e]);
+                    }
+                }
+                sort(fresh.begin(), fresh.end(), byDegree);
+                order.insert(order.end(), fresh.begin(), fresh.end());
+            }
+        }
+        reverse(order.begin(), order.end());
+        return order;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_STATEORDERING_H
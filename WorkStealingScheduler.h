@@ -0,0 +1,169 @@
+//
+// Created by Akash Shrivastva on 11/9/23.
+//
+
+#ifndef MARKOVPROCESSSOLVER_WORKSTEALINGSCHEDULER_H
+#define MARKOVPROCESSSOLVER_WORKSTEALINGSCHEDULER_H
+
+#include "vector"
+#include "deque"
+#include "functional"
+#include "thread"
+#include "mutex"
+#include "condition_variable"
+#include "atomic"
+#include "memory"
+
+using namespace std;
+
+// Runs ranges of work items on a fixed set of threads. Each call to run()
+// deals its chunks out to per-thread queues in order; a thread works through
+// its own queue from the back and, once that is empty, steals from the front
+// of the others. The calling thread works as thread 0, so a scheduler of one
+// thread simply runs every chunk in place.
+class WorkStealingScheduler {
+
+private:
+    struct Queue {
+        mutex lock;
+        deque<pair<int, int>> chunks;
+    };
+
+    int threads;
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> helpers;
+    const function<void(int, int, int)> *body;
+    atomic<int> remaining;
+    int generation;
+    bool stopped;
+    mutex lock;
+    condition_variable wake, finished;
+
+    bool next(int self, pair<int, int> &chunk) {
+        {
+            unique_lock<mutex> guard(queues[self]->lock);
+            if (!queues[self]->chunks.empty()) {
+                chunk = queues[self]->chunks.back();
+                queues[self]->chunks.pop_back();
+                return true;
+            }
+        }
+        for (int i=1; i<threads; i++) {
+            Queue &victim = *queues[(self + i) % threads];
+            unique_lock<mutex> guard(victim.lock);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.front();
+                victim.chunks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(int self) {
+        pair<int, int> chunk;
+        while (next(self, chunk)) {
+            (*body)(chunk.first, chunk.second, self);
+            if (remaining.fetch_sub(1) == 1) {
+                unique_lock<mutex> guard(lock);
+                finished.notify_all();
+            }
+        }
+    }
+
+    void help(int self) {
+        int seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [this, seen] { return stopped || generation != seen; });
+                if (stopped) {
+                    return;
+                }
+                seen = generation;
+            }
+            drain(self);
+        }
+    }
+
+public:
+    WorkStealingScheduler(int threads) {
+        this->threads = max(1, threads);
+        this->body = nullptr;
+        this->remaining = 0;
+        this->generation = 0;
+        this->stopped = false;
+        for (int i=0; i<this->threads; i++) {
+            queues.push_back(unique_ptr<Queue>(new Queue()));
+        }
+        for (int i=1; i<this->threads; i++) {
+            helpers.push_back(thread(&WorkStealingScheduler::help, this, i));
+        }
+    }
+
+    ~WorkStealingScheduler() {
+        {
+            unique_lock<mutex> guard(lock);
+            stopped = true;
+            wake.notify_all();
+        }
+        for (thread& helper: helpers) {
+            helper.join();
+        }
+    }
+
+    int size() {
+        return threads;
+    }
+
+    // calls body(begin, end, thread) once for every chunk and returns when all
+    // of them are done
+    void run(const vector<pair<int, int>> &chunks, const function<void(int, int, int)> &body) {
+        if (chunks.empty()) {
+            return;
+        }
+        this->body = &body;
+        remaining = chunks.size();
+        for (int i=0; i<chunks.size(); i++) {
+            Queue &queue = *queues[(long long) i*threads/chunks.size()];
+            unique_lock<mutex> guard(queue.lock);
+            queue.chunks.push_front(chunks[i]);
+        }
+        {
+            unique_lock<mutex> guard(lock);
+            generation++;
+            wake.notify_all();
+        }
+
+        drain(0);
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [this] { return remaining == 0; });
+    }
+
+    // Splits states 0..n-1 into contiguous chunks of roughly equal cost, where
+    // a state costs one plus its number of edges (offset is the CSR offset
+    // array). A state with more edges than a chunk's share gets a chunk of its own.
+    static vector<pair<int, int>> chunksByCost(const vector<int> &offset, int chunks) {
+        int n = offset.size() - 1;
+        long long total = n + offset[n];
+        long long share = max(1LL, total/max(1, chunks));
+        vector<pair<int, int>> result;
+        int begin = 0;
+        long long cost = 0;
+        for (int s=0; s<n; s++) {
+            long long stateCost = 1 + offset[s+1] - offset[s];
+            if (cost > 0 && cost + stateCost > share) {
+                result.push_back(make_pair(begin, s));
+                begin = s;
+                cost = 0;
+            }
+            cost += stateCost;
+        }
+        if (begin < n) {
+            result.push_back(make_pair(begin, n));
+        }
+        return result;
+    }
+};
+
+#endif //MARKOVPROCESSSOLVER_WORKSTEALINGSCHEDULER_H